@@ -3,35 +3,98 @@
 #pragma once
 
 #include "d3d12.h"
+#include <atomic>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <wrl/client.h>
 
+class FileCache;
+
+// Backed by the D3D12 shader cache session where there is one. Otherwise, or if
+// CLON12_SHADER_CACHE_DIR names a directory, by a file per adapter model in that directory, or in
+// the user's cache directory by default.
+//
+// Lookups are first checked against an in-memory LRU of recently found or stored values, so that
+// entries needed over and over don't go to the disk-backed session each time. Values are shared
+// and immutable, so a hit doesn't copy them.
 class ShaderCache
 {
 public:
-    ShaderCache(ID3D12Device*);
+    ShaderCache(ID3D12Device*, uint32_t VendorId, uint32_t DeviceId);
+    ~ShaderCache();
 
     bool HasCache() const
     {
 #ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
-        return m_pSession;
-#else
-        return false;
+        if (m_pSession)
+            return true;
 #endif
+        return m_File != nullptr;
     }
 
     void Store(const void* key, size_t keySize, const void* value, size_t valueSize) noexcept;
+    // Multi-part keys are condensed into a SHA-256 of their parts, computed without concatenating them.
+    // With CLON12_SHADER_CACHE_VERIFY_KEYS set, the parts are also stored ahead of the value and
+    // compared on lookup, so that even a hash collision is a miss rather than the wrong value.
     void Store(const void* const* keys, const size_t* keySizes, unsigned keyParts, const void* value, size_t valueSize);
 
-    using FoundValue = std::pair<std::unique_ptr<byte[]>, size_t>;
+    using FoundValue = std::pair<std::shared_ptr<const byte[]>, size_t>;
     FoundValue Find(const void* key, size_t keySize);
     FoundValue Find(const void* const* keys, const size_t* keySizes, unsigned keyParts);
 
     void Close();
 
+    // Bytes of keys and values kept in memory. Defaults to 32MB, can be overridden with
+    // CLON12_SHADER_CACHE_MEMORY_BUDGET, and 0 disables the in-memory tier.
+    static size_t GetMemoryBudget();
+    // Size at which the file backend is compacted. Defaults to 256MB, can be overridden with
+    // CLON12_SHADER_CACHE_MAX_SIZE.
+    static uint64_t GetFileMaxSize();
+
+    // Counters for the in-memory tier. Misses are lookups that went to the session.
+    struct Stats
+    {
+        std::atomic<uint64_t> m_Hits{ 0 };
+        std::atomic<uint64_t> m_Misses{ 0 };
+        std::atomic<uint64_t> m_Evictions{ 0 };
+    };
+    Stats const& GetStats() const noexcept { return m_Stats; }
+
+    // What multi-part keys are stored under
+    struct HashedKey
+    {
+        char Tag[4];
+        uint32_t NumParts;
+        uint8_t Hash[32];
+    };
+    static HashedKey HashKey(const void* const* keys, const size_t* keySizes, unsigned keyParts) noexcept;
+    static bool VerifyKeys();
+
 #ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
 private:
     Microsoft::WRL::ComPtr<ID3D12ShaderCacheSession> m_pSession;
 #endif
+
+private:
+    std::shared_ptr<FileCache> m_File;
+
+    FoundValue FindInMemory(std::string_view key);
+    void InsertInMemory(std::string_view key, FoundValue const& value);
+
+    struct MemoryEntry
+    {
+        std::string m_Key;
+        FoundValue m_Value;
+    };
+    std::mutex m_MemoryLock;
+    // Most recently used first. The index's keys point into the entries.
+    std::list<MemoryEntry> m_MemoryEntries;
+    std::unordered_map<std::string_view, std::list<MemoryEntry>::iterator> m_MemoryIndex;
+    size_t m_MemorySize = 0;
+    Stats m_Stats;
 };
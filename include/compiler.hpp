@@ -175,7 +175,20 @@ public:
     void Sign();
     Metadata const& GetMetadata() const;
 
+    // Round-trips a specialized kernel through the shader cache. Only the signed DXIL and the parts of
+    // the metadata that depend on the configuration are stored, the rest comes from the generic DXIL
+    // for the same kernel, which must outlive the deserialized object.
+    std::vector<std::byte> SerializeSpecialization() const;
+    static std::unique_ptr<CompiledDxil> DeserializeSpecialization(CompiledDxil const& generic, const void *data, size_t size);
+
+    // Round-trips a generic kernel through a program binary. Everything except the kernel info, which
+    // comes from the parsed SPIR-V, is stored. Returns null if the data doesn't match the binary.
+    std::vector<std::byte> SerializeGeneric() const;
+    static std::unique_ptr<CompiledDxil> DeserializeGeneric(ProgramBinary const& parent, const char *name, const void *data, size_t size);
+
 protected:
+    CompiledDxil(ProgramBinary const& parent, Metadata const& metadata);
+
     Metadata m_Metadata;
     ProgramBinary const& m_Parent;
 };
@@ -5,6 +5,7 @@
 #include "platform.hpp"
 #include "device.hpp"
 #include "gl_tokens.hpp"
+#include "printf.hpp"
 
 struct GLProperties;
 struct d3d12_interop_device_info;
@@ -64,6 +65,10 @@ private:
     std::unique_ptr<GLInteropManager> m_GLInteropManager;
     ID3D12CommandQueue *m_GLCommandQueue = nullptr; // weak
 
+    // cl_arm_printf
+    PrintfOutput::Callback m_PrintfCallback;
+    uint32_t m_PrintfBufferSize = g_Platform->GetPrintfBufferSize();
+
     static void CL_CALLBACK DummyCallback(const char*, const void*, size_t, void*) {}
 
     friend cl_int CL_API_CALL clGetContextInfo(cl_context, cl_context_info, size_t, void*, size_t*);
@@ -106,6 +111,8 @@ public:
     GLInteropManager *GetGLManager() const noexcept { return m_GLInteropManager.get(); }
     void InsertGLWait(ID3D12Fence *fence, UINT64 value) const noexcept { m_GLCommandQueue->Wait(fence, value); }
     std::vector<D3DDeviceAndRef> GetDevices() const noexcept { return m_AssociatedDevices; }
+    PrintfOutput::Callback const& GetPrintfCallback() const noexcept { return m_PrintfCallback; }
+    uint32_t GetPrintfBufferSize() const noexcept { return m_PrintfBufferSize; }
 
     void AddDestructionCallback(DestructorCallback::Fn pfn, void* pUserData);
 };
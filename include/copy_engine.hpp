@@ -0,0 +1,94 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#pragma once
+
+#include "platform.hpp"
+#include <unordered_set>
+
+class Task;
+using Submission = std::vector<::ref_ptr_int<Task>>;
+
+// Runs large buffer-to-buffer copies on a dedicated copy queue, so that the copy engine can move
+// data while the immediate context's queue keeps running kernels. Host reads and writes aren't
+// covered: they go through the translation layer's mapping and upload paths, which are tied to its
+// own queue. Only buffers that the CPU can't map are copied here, so that host access to a copy's
+// buffers always goes through that queue, after it has waited for the copy.
+//
+// Copies are recorded into a batch, which is submitted when the next run of tasks starts, or
+// earlier if a copy needs a resource that's already in it. A batch starts once everything recorded
+// on the immediate context before it was submitted has finished. The immediate context's queue only
+// waits for it before the first later task that could observe it: one that uses the copied
+// resources, or one whose resource usage isn't known. Whatever is still outstanding at the end of
+// a submission is waited on then. The last command list the submission recorded may have been
+// submitted before that wait, so its tasks are only completed once the copy queue's fence has also
+// reached GetLastSubmitted() as of the end of the submission.
+//
+// Only used from the thread recording a device's submissions.
+class CopyEngine
+{
+public:
+    // Copies of at least this many bytes use the copy queue. CLON12_COPY_QUEUE_THRESHOLD sets it
+    // in bytes, and 0 disables the copy queue.
+    static UINT64 GetThreshold();
+
+    CopyEngine(ID3D12Device* pDevice) : m_pDevice(pDevice) {}
+    ~CopyEngine();
+
+    // Returns false if this copy can't use the copy queue, in which case the caller records it
+    // on the immediate context as usual. Both resources must be buffers, and the caller must rule
+    // out ones whose D3D12 resource it didn't create.
+    bool CopyBufferRegion(D3D12TranslationLayer::ImmediateContext& ImmCtx,
+                          D3D12TranslationLayer::Resource* pDst, UINT64 DstOffset,
+                          D3D12TranslationLayer::Resource* pSrc, UINT64 SrcOffset,
+                          UINT64 NumBytes);
+
+    // Called before recording tasks [Begin, End), including ones that will be transitioned together.
+    void SyncBeforeTasks(D3D12TranslationLayer::ImmediateContext& ImmCtx, Submission& tasks, size_t Begin, size_t End);
+    // Called at the end of a submission, before waiting for it.
+    void SyncAll(D3D12TranslationLayer::ImmediateContext& ImmCtx);
+    // Waits on the CPU for all copies, if the queue couldn't be made to wait for them.
+    void WaitForAll() noexcept;
+    // The fence value that signals all submitted copies, for WaitFor
+    UINT64 GetLastSubmitted() const noexcept { return m_LastSignaled; }
+    // Waits on the CPU for the copies submitted up to FenceValue
+    void WaitFor(UINT64 FenceValue) noexcept;
+    // Called once a submission has completed, to release what its copies were holding on to.
+    void Trim() noexcept;
+
+private:
+    void EnsureInitialized();
+    void SubmitBatch(D3D12TranslationLayer::ImmediateContext& ImmCtx);
+    void MakeImmCtxWait(D3D12TranslationLayer::ImmediateContext& ImmCtx);
+
+    ID3D12Device* const m_pDevice;
+    ComPtr<ID3D12CommandQueue> m_spQueue;
+    ComPtr<ID3D12GraphicsCommandList> m_spCommandList;
+    ComPtr<ID3D12Fence> m_spFence;
+    UINT64 m_LastSignaled = 0;
+
+    struct InFlightAllocator
+    {
+        ComPtr<ID3D12CommandAllocator> m_spAllocator;
+        UINT64 m_FenceValue;
+    };
+    std::vector<InFlightAllocator> m_Allocators;
+
+    // Resources are kept resident by the copy queue until the copies using them are done, since the
+    // translation layer's residency management doesn't know about this queue
+    struct ResidencyReference
+    {
+        ComPtr<ID3D12Pageable> m_spPageable;
+        UINT64 m_FenceValue;
+    };
+    std::vector<ResidencyReference> m_ResidentResources;
+
+    // The batch being recorded, if m_spBatchAllocator is set
+    ComPtr<ID3D12CommandAllocator> m_spBatchAllocator;
+    std::vector<ComPtr<ID3D12Pageable>> m_BatchResidency;
+    std::unordered_set<D3D12TranslationLayer::Resource*> m_BatchResources;
+
+    // Copies that the immediate context's queue hasn't been made to wait for yet, including the
+    // batch being recorded
+    UINT64 m_PendingFenceValue = 0;
+    std::unordered_set<D3D12TranslationLayer::Resource*> m_PendingResources;
+};
@@ -3,9 +3,14 @@
 #pragma once
 #include "platform.hpp"
 #include "cache.hpp"
+#include "workgroup_tuner.hpp"
+#include "view_tables.hpp"
+#include "copy_engine.hpp"
 #include <string>
 #include <vector>
 #include <mutex>
+#include <deque>
+#include <unordered_map>
 
 using ImmCtx = D3D12TranslationLayer::ImmediateContext;
 
@@ -19,6 +24,9 @@ class D3DDevice
 public:
     ID3D12Device* GetDevice() const noexcept { return m_spDevice.Get(); }
     ShaderCache &GetShaderCache() const noexcept { return m_ShaderCache; }
+    WorkGroupTuner &GetWorkGroupTuner() noexcept { return m_WorkGroupTuner; }
+    ComputeViewState &GetComputeViewState() noexcept { return m_ComputeViewState; }
+    CopyEngine &GetCopyEngine() noexcept { return m_CopyEngine; }
 
     ImmCtx& ImmCtx() noexcept { return m_ImmCtx; }
     UINT64 GetTimestampFrequency() const noexcept { return m_TimestampFrequency; }
@@ -31,6 +39,31 @@ public:
     std::unique_ptr<D3D12TranslationLayer::PipelineState> CreatePSO(D3D12TranslationLayer::COMPUTE_PIPELINE_STATE_DESC const& Desc);
     Device &GetParent() const noexcept { return m_Parent; }
 
+    // Printf buffers are recycled across dispatches on this device rather than being
+    // allocated and initialized per-dispatch. Only the header needs to be reset before reuse.
+    struct PrintfBuffer
+    {
+        D3D12TranslationLayer::unique_comptr<D3D12TranslationLayer::Resource> m_Resource;
+        std::unique_ptr<D3D12TranslationLayer::UAV> m_UAV;
+        uint32_t m_Size;
+    };
+    std::unique_ptr<PrintfBuffer> AcquirePrintfBuffer(uint32_t Size);
+    void ReturnPrintfBuffer(std::unique_ptr<PrintfBuffer> buffer) noexcept;
+
+    // Counters for how work is being batched into submissions. Each submission is also logged as a
+    // trace event, whose timestamps give the submission rate, and the totals are logged when the
+    // device is released.
+    struct SubmissionStats
+    {
+        std::atomic<uint64_t> m_Submissions{ 0 };
+        std::atomic<uint64_t> m_Tasks{ 0 };
+        // Flushes whose tasks were added to an execution that hadn't started yet
+        std::atomic<uint64_t> m_CoalescedFlushes{ 0 };
+    };
+    SubmissionStats const& GetSubmissionStats() const noexcept { return m_SubmissionStats; }
+    // CLON12_MAX_TASKS_PER_SUBMISSION overrides the default
+    static size_t GetMaxTasksPerSubmission();
+
 protected:
     D3DDevice(Device &parent, ID3D12Device *pDevice, ID3D12CommandQueue *pQueue,
               D3D12_FEATURE_DATA_D3D12_OPTIONS &options, bool IsImportedDevice);
@@ -38,7 +71,16 @@ protected:
 
     friend class Device;
 
+    void QueueExecution(std::unique_ptr<Submission> tasks);
     void ExecuteTasks(Submission& tasks);
+    // Fence values that both have to be reached for a recorded submission to have completed
+    struct RecordedFences
+    {
+        UINT64 m_ImmCtx;
+        UINT64 m_CopyQueue;
+    };
+    // Records and submits the tasks
+    RecordedFences RecordTasks(Submission& tasks);
     unsigned m_ContextCount = 1;
     const bool m_IsImportedDevice;
 
@@ -48,14 +90,24 @@ protected:
     ::ImmCtx m_ImmCtx;
 
     std::unique_ptr<Submission> m_RecordingSubmission;
+    // Executions that haven't started yet, in order. Guarded by the task pool lock.
+    std::deque<Submission*> m_QueuedExecutions;
+    SubmissionStats m_SubmissionStats;
 
     BackgroundTaskScheduler::Scheduler m_CompletionScheduler;
     mutable ShaderCache m_ShaderCache;
+    WorkGroupTuner m_WorkGroupTuner{ m_ShaderCache };
+    ComputeViewState m_ComputeViewState;
+    CopyEngine m_CopyEngine{ m_spDevice.Get() };
 
     // All PSO creations need to be kicked off behind this lock,
     // which guards the root signature cache in the immediate context
     std::mutex m_PSOCreateLock;
 
+    std::mutex m_PrintfBufferLock;
+    // Keyed by size, since contexts may use different printf buffer sizes
+    std::unordered_multimap<uint32_t, std::unique_ptr<PrintfBuffer>> m_PrintfBufferPool;
+
     UINT64 m_TimestampFrequency = 0;
     INT64 m_GPUToQPCTimestampOffset = 0;
 };
@@ -74,6 +126,7 @@ public:
     bool IsUMA();
     bool SupportsInt16();
     bool SupportsTypedUAVLoad();
+    uint32_t GetWaveWidth();
 
     std::string GetDeviceName() const;
     LUID GetAdapterLuid() const;
@@ -96,9 +149,12 @@ protected:
     std::mutex m_InitLock;
     bool m_CapsValid = false;
     D3D12_FEATURE_DATA_D3D12_OPTIONS m_D3D12Options = {};
+    D3D12_FEATURE_DATA_D3D12_OPTIONS1 m_D3D12Options1 = {};
     D3D12_FEATURE_DATA_D3D12_OPTIONS4 m_D3D12Options4 = {};
     D3D12_FEATURE_DATA_ARCHITECTURE m_Architecture = {};
     D3D_SHADER_MODEL m_ShaderModel = D3D_SHADER_MODEL_6_0;
+    // Read on every enqueue that picks its own group size, so it's available without the lock
+    std::atomic<uint32_t> m_WaveWidth{ 0 };
 };
 
 using D3DDeviceAndRef = std::pair<Device::ref_ptr_int, D3DDevice *>;
@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// A key/value store in a single file, for when the D3D12 shader cache session isn't available.
+//
+// The file is a versioned header followed by entries that are only ever appended. Each entry is
+// checksummed, so an entry that was being written when the process died is detected when the file
+// is next opened, and the file is truncated back to the last complete entry. Values are read from a
+// mapping of the file. When an append would take the file past its size limit, the most recently
+// used entries are copied into a new file which replaces the old one.
+//
+// A file is only opened by one process at a time. Another process gets no cache rather than
+// waiting for it.
+class FileCache
+{
+public:
+    using FoundValue = std::pair<std::shared_ptr<const unsigned char[]>, size_t>;
+
+    // Returns null if the file can't be opened. Caches for the same file within a process are shared.
+    // Entries written with a different version are discarded.
+    static std::shared_ptr<FileCache> Open(std::string const& Directory, std::string const& Name,
+                                           uint64_t Version, uint64_t MaxSize);
+
+    // Where caches go when CLON12_SHADER_CACHE_DIR isn't set, or empty if there's nowhere to put them
+    static std::string GetDefaultDirectory();
+
+    ~FileCache();
+
+    FoundValue Find(std::string_view Key);
+    void Store(std::string_view Key, const void* Value, size_t ValueSize) noexcept;
+
+private:
+    // The platform's file and mapping handles
+    class File;
+
+    FileCache(std::string Path, uint64_t Version, uint64_t MaxSize);
+
+    // Builds the index from the file, truncating anything after the last valid entry
+    bool Load();
+    // Makes sure the mapping covers [0, End)
+    bool EnsureMapped(uint64_t End);
+    // Rewrites the file with the most recently used entries that fit in Budget bytes
+    bool Compact(uint64_t Budget);
+
+    std::string const m_Path;
+    uint64_t const m_Version;
+    uint64_t const m_MaxSize;
+
+    std::mutex m_Lock;
+    std::unique_ptr<File> m_File;
+    uint64_t m_FileSize = 0;
+
+    struct IndexEntry
+    {
+        uint64_t m_ValueOffset;
+        uint64_t m_ValueSize;
+        // For choosing what survives compaction
+        uint64_t m_LastUse;
+    };
+    std::unordered_map<std::string, IndexEntry> m_Index;
+    uint64_t m_UseCounter = 0;
+};
@@ -0,0 +1,21 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, for condensing large inputs into keys. Unlike std::hash it's stable across runs.
+// Passing a previous result as the seed continues hashing from where it left off.
+constexpr uint64_t c_HashBytesSeed = 0xcbf29ce484222325ull;
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = c_HashBytesSeed) noexcept
+{
+    uint64_t hash = seed;
+    auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
@@ -5,8 +5,10 @@
 #include "program.hpp"
 #include "resources.hpp"
 #include <cstddef>
+#include <array>
 
 class Sampler;
+struct KernelArgBindingSet;
 class Kernel : public CLChildBase<Kernel, Program, cl_kernel>
 {
 private:
@@ -17,6 +19,25 @@ private:
     std::vector<std::byte> m_KernelArgsCbData;
     std::vector<CompiledDxil::Configuration::Arg> m_ArgMetadataToCompiler;
 
+    // Everything SetArg needs to know about an argument, flattened out of the metadata once at creation
+    struct ArgBinding
+    {
+        enum class Kind : uint8_t { Buffer, ReadOnlyImage, WritableImage, Sampler, Value, Local };
+        Kind m_Kind;
+        // Only for writable images
+        bool m_Readable;
+        uint8_t m_NumSlots;
+        // Offset into m_KernelArgsCbData, for everything except locals and samplers
+        uint32_t m_CBOffset;
+        // Required size for value arguments
+        uint32_t m_Size;
+        // Only for images
+        cl_mem_object_type m_ImageType;
+        // UAV/SRV/sampler indices. Buffers and samplers only have one, images can have several.
+        std::array<uint32_t, 3> m_Slots;
+    };
+    std::vector<ArgBinding> m_ArgBindings;
+
     // These are weak references for the API kernel object, however
     // these will be converted into strong references by an *execution*
     // of that kernel. Releasing an object *while a kernel is enqueued*
@@ -26,10 +47,32 @@ private:
     std::vector<Resource*> m_SRVs;
     std::vector<Sampler*> m_Samplers;
 
+    // The strong references taken by the most recent execution. Consecutive executions share them
+    // until a memory object or sampler argument changes. Weak, for the same reason as above.
+    // The same kernel can be enqueued from several threads at once, so the binding set is only
+    // accessed under m_BindingSetLock.
+    std::mutex m_BindingSetLock;
+    std::weak_ptr<KernelArgBindingSet> m_LastBindingSet;
+    std::atomic<bool> m_BindingsDirty{ true };
+
     std::vector<::ref_ptr<Sampler>> m_ConstSamplers;
     std::vector<::ref_ptr<Resource>> m_InlineConsts;
 
+    // Parsed once at creation, shared with clones and with in-flight printf decodes
+    std::shared_ptr<const PrintfFormatPlans> m_PrintfPlans;
+
+    // Resolved at creation so that dispatches can find existing specializations without
+    // going through the program
+    std::vector<std::pair<Device*, Program::SpecializationTable*>> m_SpecializationTables;
+
+    // Identifies this kernel to the work group tuner, only computed when tuning is enabled
+    uint64_t m_TuningHash = 0;
+
+    cl_int ValidateArg(cl_uint arg_index, size_t arg_size, const void* arg_value) const;
+    void ApplyArg(cl_uint arg_index, size_t arg_size, const void* arg_value) noexcept;
+
     friend class ExecuteKernel;
+    friend struct KernelArgBindingSet;
     friend extern CL_API_ENTRY cl_int CL_API_CALL clGetKernelInfo(cl_kernel, cl_kernel_info, size_t, void*, size_t*);
     friend extern CL_API_ENTRY cl_int CL_API_CALL clGetKernelArgInfo(cl_kernel, cl_uint, cl_kernel_arg_info, size_t, void*, size_t*);
     friend extern CL_API_ENTRY cl_int CL_API_CALL clGetKernelWorkGroupInfo(cl_kernel, cl_device_id, cl_kernel_work_group_info, size_t, void*, size_t*);
@@ -40,7 +83,11 @@ public:
     ~Kernel();
 
     cl_int SetArg(cl_uint arg_index, size_t arg_size, const void* arg_value);
+    // Sets a contiguous range of arguments, either all of them or none
+    cl_int SetArgs(cl_uint first_arg, cl_uint num_args, const size_t* arg_sizes, const void* const* arg_values);
 
     uint16_t const* GetRequiredLocalDims() const;
     uint16_t const* GetLocalDimsHint() const;
+    size_t GetLocalMemSize() const;
+    WorkGroupTuner::KernelIdentity GetTuningIdentity() const { return { m_TuningHash, m_Name }; }
 };
@@ -23,10 +23,23 @@
 #include <CL/cl_dx9_media_sharing.h>
 #include <CL/cl_icd.h>
 
+// cl_msft_set_kernel_args: sets arguments [first_arg, first_arg + num_args) of a kernel in one call.
+// Either every argument is valid and all of them are set, or an error is returned and none are.
+extern CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArgsMSFT(cl_kernel kernel,
+    cl_uint            first_arg,
+    cl_uint            num_args,
+    const size_t*      arg_sizes,
+    const void* const* arg_values);
+
+typedef cl_int (CL_API_CALL *clSetKernelArgsMSFT_fn)(
+    cl_kernel, cl_uint, cl_uint, const size_t*, const void* const*);
+
 #include <type_traits>
 #include <memory>
 #include <vector>
 #include <atomic>
+#include <mutex>
 #include <map>
 #include <algorithm>
 #ifndef assert
@@ -85,6 +98,8 @@ public:
 
 struct adopt_ref {};
 class Compiler;
+class PrintfOutput;
+struct IDxcValidator;
 
 struct TaskPoolLock
 {
@@ -113,7 +128,9 @@ public:
                                               "cl_khr_il_program "
                                               "cl_khr_3d_image_writes "
                                               "cl_khr_gl_sharing "
-                                              "cl_khr_gl_event ";
+                                              "cl_khr_gl_event "
+                                              "cl_arm_printf "
+                                              "cl_msft_set_kernel_args ";
     static constexpr const char* ICDSuffix = "oclon12";
 
     Platform(cl_icd_dispatch* dispatch);
@@ -125,12 +142,25 @@ public:
     XPlatHelpers::unique_module const& GetDXIL();
     void UnloadCompiler();
 
+    // DXIL validators are pooled, since creating one for every kernel is a measurable part of
+    // specializing it. Acquire returns null if DXIL.dll can't be loaded. A validator is only used
+    // by one thread at a time, and goes back to the pool once that thread is done with it.
+    ComPtr<IDxcValidator> AcquireDxilValidator();
+    void ReturnDxilValidator(ComPtr<IDxcValidator> spValidator) noexcept;
+    // Queried once per process. Returns false if there's no validator.
+    bool GetDxilValidatorVersion(UINT32& Major, UINT32& Minor);
+
     TaskPoolLock GetTaskPoolLock();
     void FlushAllDevices(TaskPoolLock const& Lock);
 
     bool AnyD3DDevicesExist() const noexcept;
     void CloseCaches();
 
+    // Size of the buffer backing printf output for a single dispatch, including the 8-byte header.
+    // Defaults to 1MB, can be overridden with CLON12_PRINTF_BUFFER_SIZE.
+    uint32_t GetPrintfBufferSize() const noexcept { return m_PrintfBufferSize; }
+    PrintfOutput& GetPrintfOutput() const noexcept { return *m_PrintfOutput; }
+
     class ref_int
     {
         Platform& m_obj;
@@ -171,6 +201,79 @@ public:
         context.release();
     }
 
+    // Like QueueProgramOp, for speculative work that should only use otherwise idle CPU time
+    template <typename Fn> void QueueBackgroundProgramOp(Fn&& fn)
+    {
+        struct Context { Fn m_fn; };
+        std::unique_ptr<Context> context(new Context{ std::forward<Fn>(fn) });
+        m_BackgroundCompileScheduler.QueueTask({
+            [](void* pContext)
+            {
+                std::unique_ptr<Context> context(static_cast<Context*>(pContext));
+                context->m_fn();
+            },
+            [](void* pContext) { delete static_cast<Context*>(pContext); },
+            context.get() });
+        context.release();
+    }
+
+    // Runs fn(i) for each i in [0, Count) across the compile and link threads, returning once all
+    // of them are done. The calling thread takes indices too, so program ops can use this without
+    // waiting on threads that are themselves busy with program ops.
+    template <typename Fn> void ParallelProgramOp(size_t Count, Fn const& fn)
+    {
+        struct State
+        {
+            Fn const& m_fn;
+            size_t const m_Count;
+            std::atomic<size_t> m_Next{ 0 };
+            std::mutex m_Lock;
+            std::condition_variable m_CV;
+            size_t m_NumDone = 0;
+            std::exception_ptr m_Exception;
+
+            State(Fn const& fn, size_t Count) : m_fn(fn), m_Count(Count) {}
+
+            // Helpers that start after every index is taken return without touching m_fn,
+            // which is gone by then
+            void Run() noexcept
+            {
+                for (size_t i; (i = m_Next++) < m_Count;)
+                {
+                    std::exception_ptr exception;
+                    try { m_fn(i); }
+                    catch (...) { exception = std::current_exception(); }
+
+                    std::lock_guard lock(m_Lock);
+                    if (exception && !m_Exception)
+                        m_Exception = exception;
+                    if (++m_NumDone == m_Count)
+                        m_CV.notify_all();
+                }
+            }
+        };
+        if (Count == 0)
+            return;
+
+        auto spState = std::make_shared<State>(fn, Count);
+        size_t NumHelpers = std::min<size_t>(Count, std::max(std::thread::hardware_concurrency(), 1u)) - 1;
+        try
+        {
+            for (size_t i = 0; i < NumHelpers; ++i)
+            {
+                QueueProgramOp([spState]() { spState->Run(); });
+            }
+        }
+        catch (...) {} // Fewer helpers just means more work for this thread
+
+        spState->Run();
+
+        std::unique_lock lock(spState->m_Lock);
+        spState->m_CV.wait(lock, [&]() { return spState->m_NumDone == Count; });
+        if (spState->m_Exception)
+            std::rethrow_exception(spState->m_Exception);
+    }
+
     void DeviceInit();
     void DeviceUninit();
 
@@ -183,10 +286,21 @@ protected:
     XPlatHelpers::unique_module m_DXIL;
     unsigned m_ActiveDeviceCount = 0;
 
+    // Declared after m_DXIL so that these are released before DXIL.dll is unloaded
+    std::mutex m_DxilValidatorLock;
+    std::vector<ComPtr<IDxcValidator>> m_DxilValidators;
+    std::once_flag m_DxilValidatorVersionOnce;
+    UINT32 m_DxilValidatorMajor = 0;
+    UINT32 m_DxilValidatorMinor = 0;
+
     std::recursive_mutex m_TaskLock;
 
+    uint32_t m_PrintfBufferSize = 1024 * 1024;
+    std::unique_ptr<PrintfOutput> m_PrintfOutput;
+
     BackgroundTaskScheduler::Scheduler m_CallbackScheduler;
     BackgroundTaskScheduler::Scheduler m_CompileAndLinkScheduler;
+    BackgroundTaskScheduler::Scheduler m_BackgroundCompileScheduler;
 };
 extern Platform* g_Platform;
 
@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#pragma once
+
+#include "platform.hpp"
+#include "compiler.hpp"
+#include <string>
+#include <cstdio>
+
+// A printf format string, broken down once when the kernel is created into literal text and
+// conversion specifiers. Decoding a record from the printf buffer is then just a walk over the
+// plan, without having to re-parse the format string for every work item that printed.
+class PrintfFormatPlan
+{
+public:
+    PrintfFormatPlan(CompiledDxil::Metadata::Printf const& printf);
+
+    // Size of the argument data following the format string ID in the printf buffer.
+    uint32_t GetTotalArgSize() const noexcept { return m_TotalArgSize; }
+
+    // Appends the formatted text to Output. Returns false if the format string was invalid,
+    // in which case an error message is appended instead and decoding should stop.
+    bool Decode(std::byte const* ArgData, std::string& Output) const;
+
+private:
+    enum class ConversionKind : uint8_t { String, Float, Signed, Unsigned };
+    struct Conversion
+    {
+        // Single-element format string to hand to snprintf, e.g. "%08lx"
+        char Format[16];
+        ConversionKind Kind;
+        uint8_t VectorSize;
+        // Size of each element as read from the buffer
+        uint8_t ElementSize;
+        // Offset of the argument relative to the start of the argument data
+        uint32_t ArgOffset;
+    };
+    struct Section
+    {
+        std::string Literal;
+        bool HasConversion;
+        Conversion Conv;
+    };
+
+    std::vector<Section> m_Sections;
+    // Arguments for %s conversions are offsets into the string table, which includes the format string
+    const char* m_StringTable;
+    uint32_t m_TotalArgSize = 0;
+    // If the format string couldn't be parsed, this is printed after the last valid section
+    const char* m_Error = nullptr;
+};
+
+using PrintfFormatPlans = std::vector<PrintfFormatPlan>;
+PrintfFormatPlans CreatePrintfFormatPlans(CompiledDxil::Metadata const& metadata);
+
+// Decodes a copy of a printf buffer, starting with its header, into text.
+// Size is the amount of valid data, i.e. the lesser of the bytes written and the buffer size.
+void DecodePrintfBuffer(PrintfFormatPlans const& plans, std::byte const* Data, uint32_t Size, std::string& Output);
+
+// Destination for decoded printf output. Decoding and writing happen on a dedicated worker,
+// in the order that dispatches complete, so that a kernel which prints a lot doesn't hold the
+// task pool lock and stall completion of work on every other queue.
+//
+// By default output goes to stdout. CLON12_PRINTF_FILE redirects it to a file, and contexts
+// created with CL_PRINTF_CALLBACK_ARM get their output delivered to the app's callback instead.
+class PrintfOutput
+{
+public:
+    using PfnCallback = void (CL_CALLBACK *)(const char* buffer, size_t len, size_t complete, void* user_data);
+    struct Callback
+    {
+        PfnCallback m_pfn = nullptr;
+        void* m_UserData = nullptr;
+    };
+
+    PrintfOutput();
+    ~PrintfOutput();
+
+    void SetSchedulingMode(BackgroundTaskScheduler::SchedulingMode mode) { m_Scheduler.SetSchedulingMode(mode); }
+
+    // Decode is invoked on the worker and returns the text to write.
+    // Complete indicates that the printf buffer didn't overflow.
+    template <typename Fn> void QueueOutput(Fn&& Decode, Callback const& callback, bool Complete)
+    {
+        struct Context { Fn m_fn; Callback m_Callback; bool m_Complete; PrintfOutput& m_Output; };
+        std::unique_ptr<Context> context(new Context{ std::forward<Fn>(Decode), callback, Complete, *this });
+        {
+            std::lock_guard lock(m_Lock);
+            ++m_NumQueued;
+        }
+        m_Scheduler.QueueTask({
+            [](void* pContext)
+            {
+                std::unique_ptr<Context> context(static_cast<Context*>(pContext));
+                try
+                {
+                    std::string Text = context->m_fn();
+                    context->m_Output.Write(Text, context->m_Callback, context->m_Complete);
+                }
+                catch (...) {}
+                context->m_Output.Retire();
+            },
+            [](void* pContext)
+            {
+                std::unique_ptr<Context> context(static_cast<Context*>(pContext));
+                context->m_Output.Retire();
+            },
+            context.get() });
+        context.release();
+    }
+
+    // Output is written in the order it's queued, so a position in that order identifies
+    // everything queued up to that point. Tasks record the position when they complete.
+    uint64_t GetQueuedPosition();
+    // Blocks until all output up to Position has been written, so that output from a kernel is
+    // visible by the time clFinish or clWaitForEvents returns for it, without waiting for
+    // output queued after it.
+    void WaitFor(uint64_t Position);
+
+private:
+    void Write(std::string const& Text, Callback const& callback, bool Complete);
+    void Retire() noexcept;
+
+    std::mutex m_Lock;
+    std::condition_variable m_RetiredEvent;
+    uint64_t m_NumQueued = 0;
+    uint64_t m_NumRetired = 0;
+
+    FILE* m_File = stdout;
+    bool m_OwnsFile = false;
+
+    BackgroundTaskScheduler::Scheduler m_Scheduler;
+};
@@ -4,6 +4,8 @@
 
 #include "context.hpp"
 #include "compiler.hpp"
+#include <atomic>
+#include <optional>
 #include <variant>
 #undef GetBinaryType
 
@@ -28,7 +30,13 @@ public:
     cl_int Compile(std::vector<D3DDeviceAndRef> Devices, const char* options, cl_uint num_input_headers, const cl_program *input_headers, const char**header_include_names, Callback pfn_notify, void* user_data);
     cl_int Link(const char* options, cl_uint num_input_programs, const cl_program* input_programs, Callback pfn_notify, void* user_data);
 
-    void StoreBinary(Device* Device, unique_spirv OwnedBinary, cl_program_binary_type Type);
+    // Generic DXIL carried by a program binary, so that building it doesn't have to generate it again
+    struct EmbeddedDxil
+    {
+        uint64_t CompilerVersion;
+        std::map<std::string, std::vector<std::byte>> Kernels;
+    };
+    void StoreBinary(Device* Device, unique_spirv OwnedBinary, cl_program_binary_type Type, std::unique_ptr<EmbeddedDxil> Embedded = nullptr);
 
     const ProgramBinary* GetSpirV(Device* device) const;
 
@@ -69,16 +77,23 @@ public:
             } SamplerArgData;
         } Args[1];
         static std::unique_ptr<SpecializationKey> Allocate(D3DDevice const* Device, CompiledDxil::Configuration const& conf);
+
+        // The packed forms of a configuration, for comparing against keys without allocating one.
+        // PackConfig ignores conf.args.
+        static uint64_t PackConfig(CompiledDxil::Configuration const& conf);
+        static PackedArgData PackArg(CompiledDxil::Configuration::Arg const& arg);
     private:
         SpecializationKey(D3DDevice const* Device, CompiledDxil::Configuration const& conf);
     };
     struct SpecializationKeyHash
     {
-        size_t operator()(std::unique_ptr<SpecializationKey> const&) const;
+        size_t operator()(SpecializationKey const*) const;
+        size_t operator()(std::unique_ptr<SpecializationKey> const& ptr) const { return (*this)(ptr.get()); }
     };
     struct SpecializationKeyEqual
     {
-        bool operator()(std::unique_ptr<SpecializationKey> const& a, std::unique_ptr<SpecializationKey> const& b) const;
+        bool operator()(SpecializationKey const* a, SpecializationKey const* b) const;
+        bool operator()(std::unique_ptr<SpecializationKey> const& a, std::unique_ptr<SpecializationKey> const& b) const { return (*this)(a.get(), b.get()); }
     };
     struct SpecializationValue
     {
@@ -89,7 +104,73 @@ public:
             : m_Dxil(std::move(d)), m_Shader(std::move(s)), m_PSO(std::move(p)) { }
     };
 
-    SpecializationValue *FindExistingSpecialization(Device* device, std::string const& kernelName, std::unique_ptr<SpecializationKey> const& key) const;
+    // A specialization that's being compiled. Any number of dispatches can wait on the same one.
+    class PendingSpecialization
+    {
+    public:
+        // Returns null if the specialization failed to compile.
+        SpecializationValue *Wait();
+        void Complete(SpecializationValue *value);
+
+    private:
+        std::mutex m_Lock;
+        std::condition_variable m_Event;
+        SpecializationValue *m_Value = nullptr;
+        bool m_Done = false;
+    };
+
+    struct SpecializationLookup
+    {
+        // Set if the specialization has already been compiled
+        SpecializationValue *Existing = nullptr;
+        // Otherwise, the in-flight compile to wait on
+        std::shared_ptr<PendingSpecialization> Pending;
+        // True if the caller is responsible for compiling the specialization, and must follow
+        // up with either StoreSpecialization or AbandonSpecialization with the same key
+        bool ShouldCompile = false;
+    };
+    // Read-mostly index of a kernel's compiled specializations on one device. Lookups are lock-free and
+    // don't allocate, so the common case of dispatching an already-specialized kernel stays cheap.
+    // Entries are only ever added, by StoreSpecialization, which serializes writers.
+    class SpecializationTable
+    {
+    public:
+        SpecializationTable();
+        ~SpecializationTable();
+
+        SpecializationValue *Find(uint64_t configData, CompiledDxil::Configuration::Arg const* args, uint32_t numArgs) const noexcept;
+        void Insert(SpecializationKey const* key, SpecializationValue *value);
+
+    private:
+        struct Slot
+        {
+            std::atomic<SpecializationKey const*> m_Key{ nullptr };
+            SpecializationValue *m_Value = nullptr;
+            size_t m_Hash = 0;
+        };
+        struct Slots
+        {
+            std::unique_ptr<Slot[]> m_Slots;
+            uint32_t m_Mask;
+        };
+        static size_t Hash(SpecializationKey const* key);
+
+        std::atomic<Slots const*> m_Current;
+        uint32_t m_Count = 0;
+        // Readers may still be probing a table that's been replaced, so old tables are
+        // kept alive until the kernel's build data goes away. They at most double the size.
+        std::vector<std::unique_ptr<Slots>> m_AllSlots;
+    };
+    // One entry per device the kernel was built for.
+    std::vector<std::pair<Device*, SpecializationTable*>> GetSpecializationTables(std::string const& kernelName) const;
+
+    SpecializationLookup FindOrBeginSpecialization(Device* device, std::string const& kernelName, std::unique_ptr<SpecializationKey> const& key);
+    void AbandonSpecialization(Device* device, std::string const& kernelName, std::unique_ptr<SpecializationKey> const& key);
+
+    // Specialized DXIL is also persisted in the device's shader cache, keyed on the linked SPIR-V,
+    // so that it survives across processes.
+    unique_dxil FindCachedSpecialization(Device* device, CompiledDxil const& generic, SpecializationKey const& key) const;
+    void CacheSpecialization(Device* device, CompiledDxil const& specialized, SpecializationKey const& key) const;
     
     template <typename... TArgs>
     SpecializationValue *StoreSpecialization(Device* device, std::string const& kernelName, std::unique_ptr<SpecializationKey>& key, TArgs&&... args)
@@ -99,7 +180,20 @@ public:
         std::lock_guard specializationCacheLock(buildData->m_SpecializationCacheLock);
         auto kernelsIter = buildData->m_Kernels.find(kernelName);
         assert(kernelsIter != buildData->m_Kernels.end());
-        auto ret = kernelsIter->second.m_SpecializationCache.try_emplace(std::move(key), std::forward<TArgs>(args)...);
+        auto& kernel = kernelsIter->second;
+
+        std::shared_ptr<PendingSpecialization> pending;
+        if (auto pendingIter = kernel.m_PendingSpecializations.find(key.get()); pendingIter != kernel.m_PendingSpecializations.end())
+        {
+            pending = std::move(pendingIter->second);
+            kernel.m_PendingSpecializations.erase(pendingIter);
+        }
+
+        auto ret = kernel.m_SpecializationCache.try_emplace(std::move(key), std::forward<TArgs>(args)...);
+        if (ret.second)
+            kernel.m_SpecializationTable.Insert(ret.first->first.get(), &ret.first->second);
+        if (pending)
+            pending->Complete(&ret.first->second);
         return &ret.first->second;
     }
 
@@ -112,8 +206,16 @@ private:
         KernelData(unique_dxil d) : m_GenericDxil(std::move(d)) {}
 
         unique_dxil m_GenericDxil;
+        // Only set when generic DXIL is generated on demand, in which case m_GenericDxil is only
+        // valid after going through GetGenericDxil, or once m_Generated is set
+        std::unique_ptr<std::once_flag> m_GenerateOnce;
+        std::atomic<bool> m_Generated{ false };
         std::unordered_map<std::unique_ptr<SpecializationKey>, SpecializationValue,
             SpecializationKeyHash, SpecializationKeyEqual> m_SpecializationCache;
+        SpecializationTable m_SpecializationTable;
+        // Keys are owned by whoever is compiling the specialization, until it's stored in the cache
+        std::unordered_map<SpecializationKey const*, std::shared_ptr<PendingSpecialization>,
+            SpecializationKeyHash, SpecializationKeyEqual> m_PendingSpecializations;
     };
 
     struct PerDeviceData
@@ -126,15 +228,50 @@ private:
         cl_program_binary_type m_BinaryType = CL_PROGRAM_BINARY_TYPE_NONE;
         std::string m_LastBuildOptions;
         std::map<std::string, KernelData> m_Kernels;
+        // Only until the binary it came with is built
+        std::unique_ptr<EmbeddedDxil> m_EmbeddedDxil;
 
         uint32_t m_NumPendingLinks = 0;
 
-        void CreateKernels(Program& program);
+        // Generic DXIL for each kernel in an executable binary, generated without the program lock
+        // and then published into m_Kernels with it held. With CLON12_LAZY_KERNELS=1, generation is
+        // deferred until a kernel is first created, and idle threads prewarm the rest.
+        struct GenericKernels
+        {
+            std::vector<std::pair<std::string, unique_dxil>> m_Dxil;
+            // Per kernel, so that the build log doesn't depend on which kernel finished first
+            std::vector<std::string> m_Logs;
+            bool m_Deferred = false;
+        };
+        GenericKernels GenerateKernels(ProgramBinary const& binary) const;
+        // Empty unless every kernel's generic DXIL is available. Serialized on first use, with the
+        // program lock held, and then kept so that the binary's size doesn't change between queries.
+        std::vector<std::byte> const& GetEmbeddedDxilSection();
+        std::optional<std::vector<std::byte>> m_EmbeddedDxilSection;
 
         std::mutex m_SpecializationCacheLock;
     };
     std::unordered_map<Device*, std::shared_ptr<PerDeviceData>> m_BuildData;
 
+    // One device's share of linking SPIR-V, done by LinkDevices without the program lock
+    struct DeviceLink
+    {
+        std::shared_ptr<PerDeviceData> BuildData;
+        std::vector<ProgramBinary const*> Inputs;
+        unique_spirv Linked;
+        PerDeviceData::GenericKernels Kernels;
+        std::string Log;
+    };
+    void LinkDevices(std::vector<DeviceLink>& links, bool createLibrary);
+    // Instead of linking, if the binary carries DXIL from this compiler
+    bool UseEmbeddedDxil(DeviceLink& link);
+    void CreateKernels(std::shared_ptr<PerDeviceData> const& buildData, PerDeviceData::GenericKernels kernels);
+    // Called without the program lock, since it may have to generate the DXIL
+    CompiledDxil const* GetGenericDxil(PerDeviceData& buildData, std::string const& name, KernelData& kernel);
+    // Generates the DXIL for deferred kernels, so that it can be embedded in the program's binaries.
+    // Called without the program lock.
+    void FinishDeferredKernels() noexcept;
+
     friend struct Loggers;
 
     std::vector<D3DDeviceAndRef> m_AssociatedDevices;
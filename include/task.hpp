@@ -76,6 +76,7 @@ class Task : public CLChildBase<Task, Context, cl_event>
 public:
     struct DependencyException {};
     friend class D3DDevice;
+    friend class CopyEngine;
     enum class State
     {
         // API-visible states (sorted in reverse order so CL_COMPLETE == CL_SUCCESS == 0)
@@ -93,6 +94,7 @@ public:
     cl_ulong& GetTimestamp(cl_profiling_info timestampType);
 
     void AddDependencies(const cl_event* event_wait_list, cl_uint num_events_in_wait_list, TaskPoolLock const&);
+    // Also waits for the task's printf output, and that of everything it depended on, to be written
     cl_int WaitForCompletion();
     void RegisterCallback(cl_int command_exec_callback_type, NotificationRequest::Fn pfn_notify, void* user_data);
 
@@ -118,6 +120,17 @@ protected:
     virtual void RecordImpl() = 0;
     virtual void OnComplete() { }
 
+    // Describes what a task's shaders or copies access, so that the device can transition the resources for
+    // a run of non-conflicting tasks up front in one batch. Returns false for tasks whose accesses
+    // aren't fully described this way.
+    struct ResourceUsage
+    {
+        D3D12TranslationLayer::Resource* m_Resource;
+        D3D12_RESOURCE_STATES m_State;
+        bool m_Written;
+    };
+    virtual bool GetResourceUsage(std::vector<ResourceUsage>&) { return false; }
+
     void FireNotification(NotificationRequest const& callback, cl_int state);
     void FireNotifications();
 
@@ -135,6 +148,10 @@ protected:
 
     std::shared_ptr<D3D12TranslationLayer::Query> m_StartTimestamp;
     std::shared_ptr<D3D12TranslationLayer::Query> m_StopTimestamp;
+
+    // Printf output queued by the time this task completed, which includes this task's own output
+    // and that of every task it depended on. Waited for before anything observes the completion.
+    uint64_t m_PrintfPosition = 0;
 };
 
 class UserEvent : public Task
@@ -156,6 +173,7 @@ public:
 private:
     void RecordImpl() final { }
     void MigrateResources() final { }
+    bool GetResourceUsage(std::vector<ResourceUsage>&) final { return true; }
 };
 
 class Barrier : public Task
@@ -166,6 +184,7 @@ public:
 private:
     void RecordImpl() final { }
     void MigrateResources() final { }
+    bool GetResourceUsage(std::vector<ResourceUsage>&) final { return true; }
 };
 
 class Resource;
@@ -0,0 +1,76 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#pragma once
+
+#include "platform.hpp"
+#include <unordered_map>
+
+// Hash-consed lists of views. Interning the same views in the same order returns the same table,
+// so whether a dispatch binds what the previous one bound is a pointer comparison.
+//
+// Tables only hold view pointers, so an entry outliving its views is harmless: a new view at the
+// same address produces an identical table. What must not outlive the views is the knowledge of what
+// is bound, which is why ComputeViewState::m_Bound is reset at the end of each submission.
+template <typename TView>
+class ViewTableCache
+{
+public:
+    using Table = std::vector<TView*>;
+
+    std::shared_ptr<const Table> Intern(TView* const* Views, size_t Count)
+    {
+        size_t Hash = Count;
+        for (size_t i = 0; i < Count; ++i)
+        {
+            D3D12TranslationLayer::hash_combine(Hash, std::hash<const void*>()(Views[i]));
+        }
+
+        auto [Begin, End] = m_Tables.equal_range(Hash);
+        for (auto iter = Begin; iter != End; ++iter)
+        {
+            Table const& Candidate = *iter->second;
+            if (Candidate.size() == Count && std::equal(Candidate.begin(), Candidate.end(), Views))
+                return iter->second;
+        }
+
+        // Tables stay referenced by whoever interned them, so dropping the whole cache is always safe
+        if (m_Tables.size() >= MaxTables)
+            m_Tables.clear();
+
+        auto NewTable = std::make_shared<const Table>(Views, Views + Count);
+        m_Tables.emplace(Hash, NewTable);
+        return NewTable;
+    }
+
+private:
+    static constexpr size_t MaxTables = 4096;
+    std::unordered_multimap<size_t, std::shared_ptr<const Table>> m_Tables;
+};
+
+struct ComputeViewTables
+{
+    std::shared_ptr<const ViewTableCache<D3D12TranslationLayer::UAV>::Table> m_UAVs;
+    std::shared_ptr<const ViewTableCache<D3D12TranslationLayer::SRV>::Table> m_SRVs;
+    std::shared_ptr<const ViewTableCache<D3D12TranslationLayer::Sampler>::Table> m_Samplers;
+};
+
+// Per-device state of the compute stage, so that consecutive kernels only set what differs.
+// Only used while recording, which a device only does for one submission at a time.
+struct ComputeViewState
+{
+    ViewTableCache<D3D12TranslationLayer::UAV> m_UAVTables;
+    ViewTableCache<D3D12TranslationLayer::SRV> m_SRVTables;
+    ViewTableCache<D3D12TranslationLayer::Sampler> m_SamplerTables;
+
+    // What the immediate context currently has bound. Views bound during a submission are kept
+    // alive by its tasks until it completes, so this is only trusted within one submission.
+    ComputeViewTables m_Bound;
+    D3D12TranslationLayer::PipelineState* m_BoundPSO = nullptr;
+
+    bool HasBindings() const noexcept { return m_BoundPSO || m_Bound.m_UAVs || m_Bound.m_SRVs || m_Bound.m_Samplers; }
+    void Reset() noexcept
+    {
+        m_Bound = {};
+        m_BoundPSO = nullptr;
+    }
+};
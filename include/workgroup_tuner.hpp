@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#pragma once
+
+#include "platform.hpp"
+#include <array>
+#include <string>
+#include <unordered_map>
+
+class ShaderCache;
+
+// Helpers for picking a local size when the app doesn't specify one.
+// All of these preserve the invariant that each dimension of the local size evenly divides the global size.
+namespace WorkGroupSizing
+{
+    // The largest value <= Limit that evenly divides Value.
+    uint16_t LargestDivisorAtMost(size_t Value, uint16_t Limit);
+
+    // Shrinks the local size until it fits in D3D12's per-group thread limit, reducing the largest
+    // dimension first so the group stays as square as possible.
+    void FitToMaxThreads(std::array<uint16_t, 3>& LocalSizes, cl_uint work_dim, size_t const* global_work_size);
+
+    // Starting shape for a dispatch with no local size or hint. Groups are sized to a multiple of the
+    // wave width, and grow for kernels that use a lot of local memory, since that memory is allocated
+    // per group regardless of how many threads are in it.
+    std::array<uint16_t, 3> HeuristicLocalSize(cl_uint work_dim, uint32_t WaveWidth, size_t LocalMemSize);
+}
+
+// Optional (CLON12_WORKGROUP_AUTOTUNE=1) runtime tuning of local sizes for dispatches which don't
+// specify one. For each kernel and class of global sizes, a handful of candidate local sizes are
+// timed with GPU timestamps as the app runs, and the fastest one is used from then on. Results are
+// persisted in the device's shader cache so that later runs start out tuned.
+class WorkGroupTuner
+{
+public:
+    static bool IsEnabled();
+
+    struct KernelIdentity
+    {
+        // Stable hash of the kernel's generic DXIL, so that identical programs share results,
+        // including across runs
+        uint64_t BinaryHash;
+        std::string const& Name;
+    };
+
+    // Handed out with a candidate that should be timed. Invalid if the dispatch shouldn't be measured.
+    struct Sample
+    {
+        uint64_t EntryKey = 0;
+        uint32_t Candidate = UINT_MAX;
+        uint64_t NumWorkItems = 0;
+        bool IsValid() const noexcept { return Candidate != UINT_MAX; }
+    };
+
+    WorkGroupTuner(ShaderCache& Cache) : m_Cache(Cache) {}
+
+    // Returns true if LocalSizes was replaced with a tuned or candidate size.
+    bool Choose(KernelIdentity const& Kernel, cl_uint work_dim, size_t const* global_work_size,
+                std::array<uint16_t, 3>& LocalSizes, Sample& SampleOut);
+    void ReportSample(Sample const& Sample, uint64_t Nanoseconds) noexcept;
+
+private:
+    static constexpr uint32_t SamplesPerCandidate = 3;
+    // Dispatches of an entry after which a sample that hasn't been reported is assumed to be lost,
+    // e.g. because its dispatch failed or its timestamps couldn't be read
+    static constexpr uint32_t SampleTimeout = 64;
+    // Dispatches per candidate after which tuning settles for what it has measured, since sizes in
+    // the same class may not share divisors and some candidates may never be valid to hand out
+    static constexpr uint32_t MaxDispatchesPerCandidate = 16;
+
+    struct Candidate
+    {
+        std::array<uint16_t, 3> LocalSizes;
+        // Best observed time per work item, in picoseconds to keep some precision for small dispatches
+        uint64_t BestTime = UINT64_MAX;
+        uint32_t NumReported = 0;
+        uint32_t NumOutstanding = 0;
+        uint32_t LastHandedOut = 0;
+    };
+
+    struct Entry
+    {
+        std::vector<std::byte> CacheKey;
+        std::vector<Candidate> Candidates;
+        uint32_t NumDispatches = 0;
+        bool Tuned = false;
+        std::array<uint16_t, 3> Result = {};
+    };
+
+    Entry& GetEntry(uint64_t Key, KernelIdentity const& Kernel, cl_uint work_dim, std::array<uint8_t, 3> const& SizeClass,
+                    size_t const* global_work_size, std::array<uint16_t, 3> const& Heuristic);
+    // Settles on the fastest candidate measured, or the heuristic's if none were
+    void Finish(Entry& entry) noexcept;
+
+    ShaderCache& m_Cache;
+    std::mutex m_Lock;
+    std::unordered_map<uint64_t, Entry> m_Entries;
+};
@@ -5,95 +5,399 @@
 #include "platform.hpp"
 #include "cache.hpp"
 #include "compiler.hpp"
+#include "file_cache.hpp"
 #include <numeric>
 
 #pragma warning(disable: 4100)
 
-ShaderCache::ShaderCache(ID3D12Device* d)
+static std::string GetFileCacheDirectory()
 {
+    std::string directory;
+    char *directoryStr = nullptr;
+    if (_dupenv_s(&directoryStr, nullptr, "CLON12_SHADER_CACHE_DIR") == 0 && directoryStr)
+    {
+        directory = directoryStr;
+    }
+    free(directoryStr);
+    return directory;
+}
+
+ShaderCache::ShaderCache(ID3D12Device* d, uint32_t VendorId, uint32_t DeviceId)
+{
+    auto pCompiler = g_Platform->GetCompiler();
+    std::string directory = GetFileCacheDirectory();
+
 #ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
     ComPtr<ID3D12Device9> device9;
-    if (FAILED(d->QueryInterface(device9.ReleaseAndGetAddressOf())))
-        return;
+    if (directory.empty() && SUCCEEDED(d->QueryInterface(device9.ReleaseAndGetAddressOf())))
+    {
+        D3D12_SHADER_CACHE_SESSION_DESC Desc = {};
+        // {17CB474E-4C55-4DBC-BC2E-D5132115BDA3}
+        Desc.Identifier = { 0x17cb474e, 0x4c55, 0x4dbc, { 0xbc, 0x2e, 0xd5, 0x13, 0x21, 0x15, 0xbd, 0xa3 } };
+        Desc.Mode = D3D12_SHADER_CACHE_MODE_DISK;
+        Desc.Version = pCompiler->GetVersionForCache();
 
-    D3D12_SHADER_CACHE_SESSION_DESC Desc = {};
-    // {17CB474E-4C55-4DBC-BC2E-D5132115BDA3}
-    Desc.Identifier = { 0x17cb474e, 0x4c55, 0x4dbc, { 0xbc, 0x2e, 0xd5, 0x13, 0x21, 0x15, 0xbd, 0xa3 } };
-    Desc.Mode = D3D12_SHADER_CACHE_MODE_DISK;
+        if (SUCCEEDED(device9->CreateShaderCacheSession(&Desc, IID_PPV_ARGS(&m_pSession))))
+            return;
+    }
+#endif
 
-    auto pCompiler = g_Platform->GetCompiler();
-    Desc.Version = pCompiler->GetVersionForCache();
+    if (directory.empty())
+        directory = FileCache::GetDefaultDirectory();
 
-    (void)device9->CreateShaderCacheSession(&Desc, IID_PPV_ARGS(&m_pSession));
-#endif
+    char name[64];
+    sprintf_s(name, "clon12_%04x_%04x.cache", VendorId, DeviceId);
+    m_File = FileCache::Open(directory, name, pCompiler->GetVersionForCache(), GetFileMaxSize());
 }
 
+ShaderCache::~ShaderCache() = default;
+
 void ShaderCache::Store(const void* key, size_t keySize, const void* value, size_t valueSize) noexcept
 {
-#ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
-    if (m_pSession)
+    if (HasCache())
     {
-        (void)m_pSession->StoreValue(key, (UINT)keySize, value, (UINT)valueSize);
-    }
+#ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
+        if (m_pSession)
+            (void)m_pSession->StoreValue(key, (UINT)keySize, value, (UINT)valueSize);
+        else
 #endif
+            m_File->Store({ static_cast<const char*>(key), keySize }, value, valueSize);
+
+        // What was just stored is likely to be looked up again soon, e.g. by another device
+        if (keySize + valueSize <= GetMemoryBudget())
+        {
+            try
+            {
+                std::shared_ptr<byte[]> copy(new byte[valueSize]);
+                memcpy(copy.get(), value, valueSize);
+                InsertInMemory({ static_cast<const char*>(key), keySize }, { std::move(copy), valueSize });
+            }
+            catch (std::bad_alloc&) {} // It's still in the backing store
+        }
+    }
 }
 
 void ShaderCache::Store(const void* const* keys, const size_t* keySizes, unsigned keyParts, const void* value, size_t valueSize)
 {
-#ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
-    if (m_pSession)
+    if (HasCache())
     {
-        size_t combinedSize = std::accumulate(keySizes, keySizes + keyParts, (size_t)0);
-        std::unique_ptr<byte[]> combinedKey(new byte[combinedSize]);
+        HashedKey key = HashKey(keys, keySizes, keyParts);
+        if (!VerifyKeys())
+        {
+            Store(&key, sizeof(key), value, valueSize);
+            return;
+        }
 
-        unsigned i = 0;
-        for (byte* ptr = combinedKey.get(); ptr != combinedKey.get() + combinedSize; ptr += keySizes[i++])
+        // Each part preceded by its size, then the value
+        size_t prefixSize = std::accumulate(keySizes, keySizes + keyParts, keyParts * sizeof(uint64_t));
+        std::unique_ptr<byte[]> combined(new byte[prefixSize + valueSize]);
+        byte* ptr = combined.get();
+        for (unsigned i = 0; i < keyParts; ++i)
         {
-            memcpy(ptr, keys[i], keySizes[i]);
+            uint64_t partSize = keySizes[i];
+            memcpy(ptr, &partSize, sizeof(partSize));
+            memcpy(ptr + sizeof(partSize), keys[i], keySizes[i]);
+            ptr += sizeof(partSize) + keySizes[i];
         }
+        memcpy(ptr, value, valueSize);
 
-        Store(combinedKey.get(), combinedSize, value, valueSize);
+        Store(&key, sizeof(key), combined.get(), prefixSize + valueSize);
     }
-#endif
 }
 
 ShaderCache::FoundValue ShaderCache::Find(const void* key, size_t keySize)
 {
+    if (!HasCache())
+        return {};
+
+    std::string_view keyView(static_cast<const char*>(key), keySize);
+    if (auto value = FindInMemory(keyView); value.first)
+    {
+        return value;
+    }
+
 #ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
     if (m_pSession)
     {
         UINT valueSize = 0;
         if (SUCCEEDED(m_pSession->FindValue(key, (UINT)keySize, nullptr, &valueSize)))
         {
-            ShaderCache::FoundValue value(new byte[valueSize], valueSize);
-            if (SUCCEEDED(m_pSession->FindValue(key, (UINT)keySize, value.first.get(), &valueSize)))
+            std::shared_ptr<byte[]> data(new byte[valueSize]);
+            if (SUCCEEDED(m_pSession->FindValue(key, (UINT)keySize, data.get(), &valueSize)))
             {
+                ShaderCache::FoundValue value(std::move(data), valueSize);
+                InsertInMemory(keyView, value);
                 return value;
             }
         }
+        return {};
     }
 #endif
-    return {};
+
+    auto found = m_File->Find(keyView);
+    if (!found.first)
+        return {};
+    ShaderCache::FoundValue value(std::move(found.first), found.second);
+    InsertInMemory(keyView, value);
+    return value;
 }
 
 ShaderCache::FoundValue ShaderCache::Find(const void* const* keys, const size_t* keySizes, unsigned keyParts)
 {
-#ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
-    if (m_pSession)
+    if (!HasCache())
+        return {};
+
+    HashedKey key = HashKey(keys, keySizes, keyParts);
+    auto found = Find(&key, sizeof(key));
+    if (!found.first || !VerifyKeys())
+        return found;
+
+    const byte* ptr = found.first.get();
+    size_t remaining = found.second;
+    for (unsigned i = 0; i < keyParts; ++i)
     {
-        size_t combinedSize = std::accumulate(keySizes, keySizes + keyParts, (size_t)0);
-        std::unique_ptr<byte[]> combinedKey(new byte[combinedSize]);
+        uint64_t partSize = 0;
+        if (remaining < sizeof(partSize))
+            return {};
+        memcpy(&partSize, ptr, sizeof(partSize));
+        if (partSize != keySizes[i] ||
+            remaining - sizeof(partSize) < partSize ||
+            memcmp(ptr + sizeof(partSize), keys[i], keySizes[i]) != 0)
+            return {};
+        ptr += sizeof(partSize) + keySizes[i];
+        remaining -= sizeof(partSize) + keySizes[i];
+    }
+
+    // Shares ownership of the whole stored value
+    return { std::shared_ptr<const byte[]>(found.first, ptr), remaining };
+}
 
-        unsigned i = 0;
-        for (byte* ptr = combinedKey.get(); ptr != combinedKey.get() + combinedSize; ptr += keySizes[i++])
+namespace
+{
+    // SHA-256, fed a piece at a time. Keys that collide would return another key's value, so the
+    // hash has to hold up against inputs that differ in only a few bits, not just be fast.
+    class KeyHasher
+    {
+    public:
+        void Update(const void* data, size_t size) noexcept
         {
-            memcpy(ptr, keys[i], keySizes[i]);
+            auto bytes = static_cast<const uint8_t*>(data);
+            m_Length += size;
+            if (m_TailSize)
+            {
+                size_t fill = std::min(size, sizeof(m_Tail) - m_TailSize);
+                memcpy(m_Tail + m_TailSize, bytes, fill);
+                m_TailSize += fill;
+                bytes += fill;
+                size -= fill;
+                if (m_TailSize < sizeof(m_Tail))
+                    return;
+                Block(m_Tail);
+                m_TailSize = 0;
+            }
+            for (; size >= sizeof(m_Tail); bytes += sizeof(m_Tail), size -= sizeof(m_Tail))
+            {
+                Block(bytes);
+            }
+            memcpy(m_Tail, bytes, size);
+            m_TailSize = size;
+        }
+
+        void Finish(uint8_t (&hash)[32]) noexcept
+        {
+            // Pad with a 1 bit, zeroes, and the length in bits, big-endian
+            uint64_t bitLength = m_Length * 8;
+            m_Tail[m_TailSize++] = 0x80;
+            if (m_TailSize > sizeof(m_Tail) - sizeof(bitLength))
+            {
+                memset(m_Tail + m_TailSize, 0, sizeof(m_Tail) - m_TailSize);
+                Block(m_Tail);
+                m_TailSize = 0;
+            }
+            memset(m_Tail + m_TailSize, 0, sizeof(m_Tail) - sizeof(bitLength) - m_TailSize);
+            for (int i = 0; i < 8; ++i)
+                m_Tail[sizeof(m_Tail) - 1 - i] = (uint8_t)(bitLength >> (i * 8));
+            Block(m_Tail);
+
+            for (int i = 0; i < 8; ++i)
+            {
+                hash[i * 4 + 0] = (uint8_t)(m_State[i] >> 24);
+                hash[i * 4 + 1] = (uint8_t)(m_State[i] >> 16);
+                hash[i * 4 + 2] = (uint8_t)(m_State[i] >> 8);
+                hash[i * 4 + 3] = (uint8_t)m_State[i];
+            }
         }
 
-        return Find(combinedKey.get(), combinedSize);
+    private:
+        static uint32_t Rotr(uint32_t x, int r) noexcept { return (x >> r) | (x << (32 - r)); }
+
+        void Block(const uint8_t* block) noexcept
+        {
+            static constexpr uint32_t K[64] =
+            {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+            };
+
+            uint32_t w[64];
+            for (int i = 0; i < 16; ++i)
+            {
+                w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+                       (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+            }
+            for (int i = 16; i < 64; ++i)
+            {
+                uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+
+            uint32_t a = m_State[0], b = m_State[1], c = m_State[2], d = m_State[3];
+            uint32_t e = m_State[4], f = m_State[5], g = m_State[6], h = m_State[7];
+            for (int i = 0; i < 64; ++i)
+            {
+                uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+                uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+            }
+            m_State[0] += a; m_State[1] += b; m_State[2] += c; m_State[3] += d;
+            m_State[4] += e; m_State[5] += f; m_State[6] += g; m_State[7] += h;
+        }
+
+        uint32_t m_State[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+        uint8_t m_Tail[64];
+        size_t m_TailSize = 0;
+        uint64_t m_Length = 0;
+    };
+}
+
+ShaderCache::HashedKey ShaderCache::HashKey(const void* const* keys, const size_t* keySizes, unsigned keyParts) noexcept
+{
+    // Hashing each part's size keeps parts from running into each other
+    KeyHasher hasher;
+    for (unsigned i = 0; i < keyParts; ++i)
+    {
+        uint64_t partSize = keySizes[i];
+        hasher.Update(&partSize, sizeof(partSize));
+        hasher.Update(keys[i], keySizes[i]);
     }
-#endif
-    return {};
+
+    // Values stored with and without verification are laid out differently, so they're kept apart
+    HashedKey key = { { 'C', 'L', 'K', VerifyKeys() ? 'V' : 'H' }, keyParts, {} };
+    hasher.Finish(key.Hash);
+    return key;
+}
+
+bool ShaderCache::VerifyKeys()
+{
+    static const bool s_Verify = []()
+    {
+        bool verify = false;
+        char *verifyStr = nullptr;
+        if (_dupenv_s(&verifyStr, nullptr, "CLON12_SHADER_CACHE_VERIFY_KEYS") == 0 && verifyStr)
+        {
+            verify = strcmp(verifyStr, "0") != 0;
+        }
+        free(verifyStr);
+        return verify;
+    }();
+    return s_Verify;
+}
+
+size_t ShaderCache::GetMemoryBudget()
+{
+    static const size_t s_Budget = []()
+    {
+        size_t budget = 32 * 1024 * 1024;
+        char *budgetStr = nullptr;
+        if (_dupenv_s(&budgetStr, nullptr, "CLON12_SHADER_CACHE_MEMORY_BUDGET") == 0 && budgetStr)
+        {
+            budget = (size_t)_strtoui64(budgetStr, nullptr, 0);
+        }
+        free(budgetStr);
+        return budget;
+    }();
+    return s_Budget;
+}
+
+uint64_t ShaderCache::GetFileMaxSize()
+{
+    static const uint64_t s_MaxSize = []()
+    {
+        uint64_t maxSize = 256 * 1024 * 1024;
+        char *maxSizeStr = nullptr;
+        if (_dupenv_s(&maxSizeStr, nullptr, "CLON12_SHADER_CACHE_MAX_SIZE") == 0 && maxSizeStr)
+        {
+            maxSize = _strtoui64(maxSizeStr, nullptr, 0);
+        }
+        free(maxSizeStr);
+        return maxSize;
+    }();
+    return s_MaxSize;
+}
+
+ShaderCache::FoundValue ShaderCache::FindInMemory(std::string_view key)
+{
+    if (GetMemoryBudget() == 0)
+        return {};
+
+    std::lock_guard lock(m_MemoryLock);
+    auto iter = m_MemoryIndex.find(key);
+    if (iter == m_MemoryIndex.end())
+    {
+        ++m_Stats.m_Misses;
+        return {};
+    }
+
+    ++m_Stats.m_Hits;
+    m_MemoryEntries.splice(m_MemoryEntries.begin(), m_MemoryEntries, iter->second);
+    return iter->second->m_Value;
+}
+
+void ShaderCache::InsertInMemory(std::string_view key, FoundValue const& value)
+{
+    const size_t budget = GetMemoryBudget();
+    const size_t size = key.size() + value.second;
+    if (size > budget)
+        return;
+
+    std::lock_guard lock(m_MemoryLock);
+    if (auto iter = m_MemoryIndex.find(key); iter != m_MemoryIndex.end())
+    {
+        // Replaced rather than updated, since readers may still hold the old value
+        auto entry = iter->second;
+        m_MemoryIndex.erase(iter);
+        m_MemorySize -= entry->m_Key.size() + entry->m_Value.second;
+        m_MemoryEntries.erase(entry);
+    }
+
+    while (m_MemorySize + size > budget)
+    {
+        MemoryEntry& victim = m_MemoryEntries.back();
+        m_MemoryIndex.erase(victim.m_Key);
+        m_MemorySize -= victim.m_Key.size() + victim.m_Value.second;
+        m_MemoryEntries.pop_back();
+        ++m_Stats.m_Evictions;
+    }
+
+    m_MemoryEntries.push_front({ std::string(key), value });
+    try
+    {
+        m_MemoryIndex.emplace(m_MemoryEntries.front().m_Key, m_MemoryEntries.begin());
+    }
+    catch (...)
+    {
+        m_MemoryEntries.pop_front();
+        throw;
+    }
+    m_MemorySize += size;
 }
 
 void ShaderCache::Close()
@@ -101,4 +405,10 @@ void ShaderCache::Close()
 #ifdef __ID3D12ShaderCacheSession_INTERFACE_DEFINED__
     m_pSession.Reset();
 #endif
+    m_File.reset();
+
+    std::lock_guard lock(m_MemoryLock);
+    m_MemoryIndex.clear();
+    m_MemoryEntries.clear();
+    m_MemorySize = 0;
 }
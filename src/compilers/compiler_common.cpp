@@ -24,17 +24,425 @@ CompiledDxil::CompiledDxil(ProgramBinary const& parent, const char *name)
 {
 }
 
+CompiledDxil::CompiledDxil(ProgramBinary const& parent, Metadata const& metadata)
+    : m_Parent(parent)
+    , m_Metadata(metadata)
+{
+}
+
 CompiledDxil::Metadata const& CompiledDxil::GetMetadata() const
 {
     return m_Metadata;
 }
 
+namespace
+{
+    struct SerializedSpecializationHeader
+    {
+        static constexpr uint32_t CurrentVersion = 1;
+        uint32_t Version;
+        uint32_t NumArgs;
+        uint32_t KernelInputsBufSize;
+        uint16_t LocalSize[3];
+        uint16_t Padding;
+        uint64_t LocalMemSize;
+        uint64_t PrivMemSize;
+        uint64_t BinarySize;
+    };
+    struct SerializedSpecializationArg
+    {
+        uint32_t Offset;
+        uint32_t Size;
+        uint32_t SharedMemOffset;
+    };
+
+    class CachedDxil : public CompiledDxil
+    {
+        std::vector<std::byte> m_Binary;
+
+    public:
+        CachedDxil(ProgramBinary const& parent, Metadata const& metadata, std::vector<std::byte> binary)
+            : CompiledDxil(parent, metadata)
+            , m_Binary(std::move(binary))
+        {
+        }
+        Metadata& GetMutableMetadata() { return m_Metadata; }
+
+        virtual size_t GetBinarySize() const final { return m_Binary.size(); }
+        virtual const void *GetBinary() const final { return m_Binary.data(); }
+        virtual void *GetBinary() final { return m_Binary.data(); }
+    };
+
+    struct SerializedGenericHeader
+    {
+        static constexpr uint32_t CurrentVersion = 1;
+        uint32_t Version;
+        uint32_t NumArgs;
+        uint32_t NumConsts;
+        uint32_t NumConstSamplers;
+        uint32_t NumPrintfs;
+        uint32_t KernelInputsCbvId;
+        uint32_t KernelInputsBufSize;
+        uint32_t WorkPropertiesCbvId;
+        int32_t PrintfUavId;
+        uint32_t Padding;
+        uint64_t NumUAVs;
+        uint64_t NumSRVs;
+        uint64_t NumSamplers;
+        uint64_t LocalMemSize;
+        uint64_t PrivMemSize;
+        uint16_t LocalSize[3];
+        uint16_t LocalSizeHint[3];
+        uint32_t Padding2;
+        uint64_t BinarySize;
+    };
+    struct SerializedGenericArg
+    {
+        uint32_t Offset;
+        uint32_t Size;
+        // Index into Metadata::Arg::properties
+        uint32_t Kind;
+        // Image buffer IDs, or the single sampler/buffer ID or shared memory offset
+        uint32_t Ids[3];
+        uint32_t NumIds;
+    };
+    struct SerializedGenericConst
+    {
+        uint32_t UavId;
+        uint32_t Padding;
+        uint64_t Size;
+    };
+    struct SerializedGenericConstSampler
+    {
+        uint32_t SamplerId;
+        uint32_t AddressingMode;
+        uint32_t FilterMode;
+        uint32_t NormalizedCoords;
+    };
+    struct SerializedGenericPrintf
+    {
+        uint32_t NumArgs;
+        uint32_t StrSize;
+    };
+
+    // Owns everything the metadata points to, since there's no compiler output to point into
+    class DeserializedGenericDxil : public CompiledDxil
+    {
+    public:
+        std::vector<std::byte> m_Binary;
+        std::vector<std::vector<std::byte>> m_ConstData;
+        std::vector<std::vector<unsigned>> m_PrintfArgSizes;
+        std::vector<std::vector<char>> m_PrintfStrings;
+
+        DeserializedGenericDxil(ProgramBinary const& parent, const char *name)
+            : CompiledDxil(parent, name)
+        {
+        }
+        Metadata& GetMutableMetadata() { return m_Metadata; }
+
+        virtual size_t GetBinarySize() const final { return m_Binary.size(); }
+        virtual const void *GetBinary() const final { return m_Binary.data(); }
+        virtual void *GetBinary() final { return m_Binary.data(); }
+    };
+
+    class BlobReader
+    {
+        const std::byte *m_Ptr;
+        const std::byte *const m_End;
+    public:
+        BlobReader(const void *data, size_t size)
+            : m_Ptr(static_cast<const std::byte*>(data)), m_End(m_Ptr + size) {}
+        bool Read(void *dest, size_t size)
+        {
+            if ((size_t)(m_End - m_Ptr) < size)
+                return false;
+            memcpy(dest, m_Ptr, size);
+            m_Ptr += size;
+            return true;
+        }
+        template <typename T> bool Read(T &dest) { return Read(&dest, sizeof(dest)); }
+        size_t Remaining() const { return m_End - m_Ptr; }
+        bool AtEnd() const { return m_Ptr == m_End; }
+    };
+
+    template <typename T> void Append(std::vector<std::byte> &data, T const& value)
+    {
+        auto bytes = reinterpret_cast<const std::byte*>(&value);
+        data.insert(data.end(), bytes, bytes + sizeof(value));
+    }
+}
+
+std::vector<std::byte> CompiledDxil::SerializeSpecialization() const
+{
+    SerializedSpecializationHeader Header = {};
+    Header.Version = SerializedSpecializationHeader::CurrentVersion;
+    Header.NumArgs = (uint32_t)m_Metadata.args.size();
+    Header.KernelInputsBufSize = m_Metadata.kernel_inputs_buf_size;
+    std::copy(m_Metadata.local_size, std::end(m_Metadata.local_size), Header.LocalSize);
+    Header.LocalMemSize = m_Metadata.local_mem_size;
+    Header.PrivMemSize = m_Metadata.priv_mem_size;
+    Header.BinarySize = GetBinarySize();
+
+    std::vector<std::byte> Data(sizeof(Header) + sizeof(SerializedSpecializationArg) * Header.NumArgs + Header.BinarySize);
+    std::byte *Ptr = Data.data();
+    memcpy(Ptr, &Header, sizeof(Header));
+    Ptr += sizeof(Header);
+    for (auto& arg : m_Metadata.args)
+    {
+        SerializedSpecializationArg Arg = { arg.offset, arg.size, 0 };
+        if (auto local = std::get_if<Metadata::Arg::Local>(&arg.properties); local)
+            Arg.SharedMemOffset = local->sharedmem_offset;
+        memcpy(Ptr, &Arg, sizeof(Arg));
+        Ptr += sizeof(Arg);
+    }
+    memcpy(Ptr, GetBinary(), Header.BinarySize);
+    return Data;
+}
+
+std::unique_ptr<CompiledDxil> CompiledDxil::DeserializeSpecialization(CompiledDxil const& generic, const void *data, size_t size)
+{
+    SerializedSpecializationHeader Header;
+    if (size < sizeof(Header))
+        return nullptr;
+    memcpy(&Header, data, sizeof(Header));
+    if (Header.Version != SerializedSpecializationHeader::CurrentVersion ||
+        Header.NumArgs != generic.m_Metadata.args.size() ||
+        size != sizeof(Header) + sizeof(SerializedSpecializationArg) * Header.NumArgs + Header.BinarySize)
+        return nullptr;
+
+    auto Ptr = static_cast<const std::byte*>(data) + sizeof(Header);
+    std::vector<std::byte> Binary(Ptr + sizeof(SerializedSpecializationArg) * Header.NumArgs, Ptr + size - sizeof(Header));
+    auto ret = std::make_unique<CachedDxil>(generic.m_Parent, generic.m_Metadata, std::move(Binary));
+
+    auto& meta = ret->GetMutableMetadata();
+    meta.kernel_inputs_buf_size = Header.KernelInputsBufSize;
+    std::copy(Header.LocalSize, std::end(Header.LocalSize), meta.local_size);
+    meta.local_mem_size = (size_t)Header.LocalMemSize;
+    meta.priv_mem_size = (size_t)Header.PrivMemSize;
+    for (auto& arg : meta.args)
+    {
+        SerializedSpecializationArg Arg;
+        memcpy(&Arg, Ptr, sizeof(Arg));
+        Ptr += sizeof(Arg);
+        arg.offset = Arg.Offset;
+        arg.size = Arg.Size;
+        if (auto local = std::get_if<Metadata::Arg::Local>(&arg.properties); local)
+            local->sharedmem_offset = Arg.SharedMemOffset;
+    }
+    return ret;
+}
+
+std::vector<std::byte> CompiledDxil::SerializeGeneric() const
+{
+    SerializedGenericHeader Header = {};
+    Header.Version = SerializedGenericHeader::CurrentVersion;
+    Header.NumArgs = (uint32_t)m_Metadata.args.size();
+    Header.NumConsts = (uint32_t)m_Metadata.consts.size();
+    Header.NumConstSamplers = (uint32_t)m_Metadata.constSamplers.size();
+    Header.NumPrintfs = (uint32_t)m_Metadata.printfs.size();
+    Header.KernelInputsCbvId = m_Metadata.kernel_inputs_cbv_id;
+    Header.KernelInputsBufSize = m_Metadata.kernel_inputs_buf_size;
+    Header.WorkPropertiesCbvId = m_Metadata.work_properties_cbv_id;
+    Header.PrintfUavId = m_Metadata.printf_uav_id;
+    Header.NumUAVs = m_Metadata.num_uavs;
+    Header.NumSRVs = m_Metadata.num_srvs;
+    Header.NumSamplers = m_Metadata.num_samplers;
+    Header.LocalMemSize = m_Metadata.local_mem_size;
+    Header.PrivMemSize = m_Metadata.priv_mem_size;
+    std::copy(m_Metadata.local_size, std::end(m_Metadata.local_size), Header.LocalSize);
+    std::copy(m_Metadata.local_size_hint, std::end(m_Metadata.local_size_hint), Header.LocalSizeHint);
+    Header.BinarySize = GetBinarySize();
+
+    std::vector<std::byte> Data;
+    Append(Data, Header);
+    for (auto& arg : m_Metadata.args)
+    {
+        SerializedGenericArg Arg = { arg.offset, arg.size, (uint32_t)arg.properties.index() };
+        if (auto image = std::get_if<Metadata::Arg::Image>(&arg.properties); image)
+        {
+            std::copy(image->buffer_ids, std::end(image->buffer_ids), Arg.Ids);
+            Arg.NumIds = image->num_buffer_ids;
+        }
+        else if (auto sampler = std::get_if<Metadata::Arg::Sampler>(&arg.properties); sampler)
+            Arg.Ids[0] = sampler->sampler_id;
+        else if (auto memory = std::get_if<Metadata::Arg::Memory>(&arg.properties); memory)
+            Arg.Ids[0] = memory->buffer_id;
+        else if (auto local = std::get_if<Metadata::Arg::Local>(&arg.properties); local)
+            Arg.Ids[0] = local->sharedmem_offset;
+        Append(Data, Arg);
+    }
+    for (auto& c : m_Metadata.consts)
+    {
+        Append(Data, SerializedGenericConst{ c.uav_id, 0, c.size });
+        auto bytes = static_cast<const std::byte*>(c.data);
+        Data.insert(Data.end(), bytes, bytes + c.size);
+    }
+    for (auto& s : m_Metadata.constSamplers)
+    {
+        Append(Data, SerializedGenericConstSampler{ s.sampler_id, s.addressing_mode, s.filter_mode, s.normalized_coords });
+    }
+    for (auto& p : m_Metadata.printfs)
+    {
+        uint32_t StrSize = p.str ? (uint32_t)strlen(p.str) + 1 : 0;
+        Append(Data, SerializedGenericPrintf{ p.num_args, StrSize });
+        auto sizes = reinterpret_cast<const std::byte*>(p.arg_sizes);
+        Data.insert(Data.end(), sizes, sizes + sizeof(unsigned) * p.num_args);
+        auto str = reinterpret_cast<const std::byte*>(p.str);
+        Data.insert(Data.end(), str, str + StrSize);
+    }
+    auto binary = static_cast<const std::byte*>(GetBinary());
+    Data.insert(Data.end(), binary, binary + Header.BinarySize);
+    return Data;
+}
+
+// Image types that kernels bind as views rather than as buffers, the same set as clCreateKernel recognizes
+static bool IsImageTypeName(const char *name)
+{
+    static const char *const ImageTypes[] =
+    {
+        "image1d_buffer_t", "image1d_t", "image1d_array_t", "image2d_t", "image2d_array_t", "image3d_t"
+    };
+    return std::any_of(std::begin(ImageTypes), std::end(ImageTypes), [name](const char *type) { return strcmp(name, type) == 0; });
+}
+
+// The data comes from an application-provided program binary, so everything that kernels later use
+// to index into their bindings or argument buffer is checked against the SPIR-V and the D3D12 limits
+static bool ValidateGenericArg(ProgramBinary::Kernel::Arg const& info, SerializedGenericArg const& Arg, SerializedGenericHeader const& Header)
+{
+    if ((uint64_t)Arg.Offset + Arg.Size > Header.KernelInputsBufSize)
+        return false;
+
+    auto IdsBelow = [&Arg](uint32_t NumIds, uint64_t Limit)
+    {
+        return std::all_of(Arg.Ids, Arg.Ids + NumIds, [Limit](uint32_t id) { return id < Limit; });
+    };
+
+    using AddressSpace = ProgramBinary::Kernel::Arg::AddressSpace;
+    switch (info.address_qualifier)
+    {
+    case AddressSpace::Global:
+    case AddressSpace::Constant:
+        if (IsImageTypeName(info.type_name))
+            return Arg.Kind == 1 && Arg.NumIds > 0 && Arg.NumIds <= std::size(Arg.Ids) &&
+                IdsBelow(Arg.NumIds, info.writable ? Header.NumUAVs : Header.NumSRVs);
+        return Arg.Kind == 3 && IdsBelow(1, Header.NumUAVs);
+    case AddressSpace::Private:
+        if (strcmp(info.type_name, "sampler_t") == 0)
+            return Arg.Kind == 2 && IdsBelow(1, Header.NumSamplers);
+        return Arg.Kind == 0;
+    case AddressSpace::Local:
+        return Arg.Kind == 4;
+    }
+    return false;
+}
+
+std::unique_ptr<CompiledDxil> CompiledDxil::DeserializeGeneric(ProgramBinary const& parent, const char *name, const void *data, size_t size)
+{
+    auto& kernels = parent.GetKernelInfo();
+    auto kernelInfo = std::find_if(kernels.begin(), kernels.end(), [name](ProgramBinary::Kernel const& k) { return strcmp(k.name, name) == 0; });
+    if (kernelInfo == kernels.end())
+        return nullptr;
+
+    BlobReader Reader(data, size);
+    SerializedGenericHeader Header;
+    if (!Reader.Read(Header) ||
+        Header.Version != SerializedGenericHeader::CurrentVersion ||
+        Header.NumArgs != kernelInfo->args.size() ||
+        Header.NumUAVs > D3D12_UAV_SLOT_COUNT ||
+        Header.NumSRVs > D3D12_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT ||
+        Header.NumSamplers > D3D12_COMMONSHADER_SAMPLER_SLOT_COUNT ||
+        Header.KernelInputsCbvId >= D3D12_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT ||
+        Header.WorkPropertiesCbvId >= D3D12_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT ||
+        (Header.PrintfUavId >= 0 && (uint64_t)Header.PrintfUavId >= Header.NumUAVs) ||
+        Header.PrintfUavId < -1)
+        return nullptr;
+
+    auto ret = std::make_unique<DeserializedGenericDxil>(parent, name);
+    auto& meta = ret->GetMutableMetadata();
+    meta.kernel_inputs_cbv_id = Header.KernelInputsCbvId;
+    meta.kernel_inputs_buf_size = Header.KernelInputsBufSize;
+    meta.work_properties_cbv_id = Header.WorkPropertiesCbvId;
+    meta.printf_uav_id = Header.PrintfUavId;
+    meta.num_uavs = (size_t)Header.NumUAVs;
+    meta.num_srvs = (size_t)Header.NumSRVs;
+    meta.num_samplers = (size_t)Header.NumSamplers;
+    meta.local_mem_size = (size_t)Header.LocalMemSize;
+    meta.priv_mem_size = (size_t)Header.PrivMemSize;
+    std::copy(Header.LocalSize, std::end(Header.LocalSize), meta.local_size);
+    std::copy(Header.LocalSizeHint, std::end(Header.LocalSizeHint), meta.local_size_hint);
+
+    for (uint32_t i = 0; i < Header.NumArgs; ++i)
+    {
+        SerializedGenericArg Arg;
+        if (!Reader.Read(Arg) || !ValidateGenericArg(kernelInfo->args[i], Arg, Header))
+            return nullptr;
+        Metadata::Arg& arg = meta.args.emplace_back();
+        arg.offset = Arg.Offset;
+        arg.size = Arg.Size;
+        switch (Arg.Kind)
+        {
+        case 0: break;
+        case 1:
+        {
+            Metadata::Arg::Image image = {};
+            if (Arg.NumIds > std::size(image.buffer_ids))
+                return nullptr;
+            std::copy(Arg.Ids, std::end(Arg.Ids), image.buffer_ids);
+            image.num_buffer_ids = Arg.NumIds;
+            arg.properties = image;
+            break;
+        }
+        case 2: arg.properties = Metadata::Arg::Sampler{ Arg.Ids[0] }; break;
+        case 3: arg.properties = Metadata::Arg::Memory{ Arg.Ids[0] }; break;
+        case 4: arg.properties = Metadata::Arg::Local{ Arg.Ids[0] }; break;
+        default: return nullptr;
+        }
+    }
+    for (uint32_t i = 0; i < Header.NumConsts; ++i)
+    {
+        SerializedGenericConst Const;
+        if (!Reader.Read(Const) || Const.UavId >= Header.NumUAVs || Const.Size > Reader.Remaining())
+            return nullptr;
+        auto& Storage = ret->m_ConstData.emplace_back((size_t)Const.Size);
+        if (!Reader.Read(Storage.data(), Storage.size()))
+            return nullptr;
+        meta.consts.push_back({ Storage.data(), Storage.size(), Const.UavId });
+    }
+    for (uint32_t i = 0; i < Header.NumConstSamplers; ++i)
+    {
+        SerializedGenericConstSampler Sampler;
+        if (!Reader.Read(Sampler) || Sampler.SamplerId >= Header.NumSamplers)
+            return nullptr;
+        meta.constSamplers.push_back({ Sampler.SamplerId, Sampler.AddressingMode, Sampler.FilterMode, Sampler.NormalizedCoords != 0 });
+    }
+    for (uint32_t i = 0; i < Header.NumPrintfs; ++i)
+    {
+        SerializedGenericPrintf Printf;
+        if (!Reader.Read(Printf) ||
+            Printf.NumArgs > Reader.Remaining() / sizeof(unsigned) ||
+            Printf.StrSize > Reader.Remaining() - sizeof(unsigned) * Printf.NumArgs)
+            return nullptr;
+        auto& ArgSizes = ret->m_PrintfArgSizes.emplace_back(Printf.NumArgs);
+        auto& Str = ret->m_PrintfStrings.emplace_back(Printf.StrSize);
+        if (!Reader.Read(ArgSizes.data(), sizeof(unsigned) * ArgSizes.size()) ||
+            !Reader.Read(Str.data(), Str.size()) ||
+            (!Str.empty() && Str.back() != '\0'))
+            return nullptr;
+        meta.printfs.push_back({ Printf.NumArgs, ArgSizes.data(), Str.empty() ? nullptr : Str.data() });
+    }
+
+    if (Header.BinarySize != Reader.Remaining())
+        return nullptr;
+    ret->m_Binary.resize((size_t)Header.BinarySize);
+    if (!Reader.Read(ret->m_Binary.data(), ret->m_Binary.size()) || !Reader.AtEnd())
+        return nullptr;
+    return ret;
+}
+
 static void SignBlob(void* pBlob, size_t size)
 {
-    auto& DXIL = g_Platform->GetDXIL();
-    auto pfnCreateInstance = DXIL.proc_address<decltype(&DxcCreateInstance)>("DxcCreateInstance");
-    ComPtr<IDxcValidator> spValidator;
-    if (SUCCEEDED(pfnCreateInstance(CLSID_DxcValidator, IID_PPV_ARGS(&spValidator))))
+    ComPtr<IDxcValidator> spValidator = g_Platform->AcquireDxilValidator();
+    if (spValidator)
     {
         struct Blob : IDxcBlob
         {
@@ -67,6 +475,7 @@ static void SignBlob(void* pBlob, size_t size)
                 printf("%S", (wchar_t*)spError->GetBufferPointer());
             DebugBreak();
         }
+        g_Platform->ReturnDxilValidator(std::move(spValidator));
     }
 }
 
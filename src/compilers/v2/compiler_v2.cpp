@@ -304,19 +304,10 @@ static dxil_shader_model TranslateShaderModel(D3D_SHADER_MODEL sm)
     }
 }
 
-static dxil_validator_version GetValidatorVersion(const XPlatHelpers::unique_module &dxil)
+static dxil_validator_version GetValidatorVersion()
 {
-    if (!dxil)
-        return NO_DXIL_VALIDATION;
-
-    auto pfnCreateInstance = dxil.proc_address<decltype(&DxcCreateInstance)>("DxcCreateInstance");
-    ComPtr<IDxcVersionInfo> versionInfo;
-    if (!pfnCreateInstance ||
-        FAILED(pfnCreateInstance(CLSID_DxcValidator, IID_PPV_ARGS(versionInfo.ReleaseAndGetAddressOf()))))
-        return NO_DXIL_VALIDATION;
-
     UINT32 major, minor;
-    if (FAILED(versionInfo->GetVersion(&major, &minor)))
+    if (!g_Platform->GetDxilValidatorVersion(major, minor))
         return NO_DXIL_VALIDATION;
 
     if (major == 1)
@@ -338,7 +329,7 @@ std::unique_ptr<CompiledDxil> CompilerV2::GetKernel(const char *name, ProgramBin
         conf_impl.support_workgroup_id_offsets = conf->support_work_group_id_offsets;
 
         conf_impl.max_shader_model = TranslateShaderModel(conf->shader_model);
-        conf_impl.validator_version = GetValidatorVersion(g_Platform->GetDXIL());
+        conf_impl.validator_version = GetValidatorVersion();
 
         conf_args.reserve(conf->args.size());
         for (auto& arg : conf->args)
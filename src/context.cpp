@@ -275,6 +275,7 @@ bool ValidateContextProperties(cl_context_properties const* properties, TReporte
         CL_CONTEXT_PLATFORM, CL_CONTEXT_INTEROP_USER_SYNC,
         CL_GL_CONTEXT_KHR, CL_EGL_DISPLAY_KHR, CL_GLX_DISPLAY_KHR,
         CL_WGL_HDC_KHR, CL_CGL_SHAREGROUP_KHR,
+        CL_PRINTF_CALLBACK_ARM, CL_PRINTF_BUFFERSIZE_ARM,
     };
     bool SeenProperties[std::extent_v<decltype(KnownProperties)>] = {};
     cl_context_properties glContext = 0;
@@ -315,6 +316,13 @@ bool ValidateContextProperties(cl_context_properties const* properties, TReporte
             return !ReportError("CGL unsupported.", CL_INVALID_OPERATION);
         case CL_GLX_DISPLAY_KHR:
             return !ReportError("GLX unsupported.", CL_INVALID_OPERATION);
+        case CL_PRINTF_BUFFERSIZE_ARM:
+            if (*(CurProp + 1) < (cl_context_properties)(sizeof(uint32_t) * 4) ||
+                (size_t)*(CurProp + 1) > UINT_MAX)
+            {
+                return !ReportError("Invalid printf buffer size.", CL_INVALID_VALUE);
+            }
+            break;
         }
     }
 
@@ -655,6 +663,16 @@ Context::Context(std::vector<D3DDeviceAndRef> Devices,
     , m_Properties(PropertiesToVector(Properties))
     , m_GLInteropManager(std::move(glManager))
 {
+    if (auto printfCallback = FindProperty<cl_context_properties>(Properties, CL_PRINTF_CALLBACK_ARM); printfCallback)
+    {
+        m_PrintfCallback.m_pfn = reinterpret_cast<PrintfOutput::PfnCallback>(*printfCallback);
+        m_PrintfCallback.m_UserData = CallbackContext;
+    }
+    if (auto printfBufferSize = FindProperty<cl_context_properties>(Properties, CL_PRINTF_BUFFERSIZE_ARM); printfBufferSize)
+    {
+        m_PrintfBufferSize = (uint32_t)*printfBufferSize & ~3u;
+    }
+
     for (auto& [device, d3ddevice] : m_AssociatedDevices)
     {
         d3d12_interop_device_info glInfo = {};
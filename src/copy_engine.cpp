@@ -0,0 +1,265 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#include "copy_engine.hpp"
+#include "task.hpp"
+
+#include <wil/resource.h>
+
+UINT64 CopyEngine::GetThreshold()
+{
+    static const UINT64 s_Threshold = []()
+    {
+        // Below this, the cost of synchronizing two queues outweighs what can be overlapped
+        UINT64 threshold = 16 * 1024 * 1024;
+        char *thresholdStr = nullptr;
+        if (_dupenv_s(&thresholdStr, nullptr, "CLON12_COPY_QUEUE_THRESHOLD") == 0 && thresholdStr)
+        {
+            threshold = _strtoui64(thresholdStr, nullptr, 0);
+        }
+        free(thresholdStr);
+        return threshold;
+    }();
+    return s_Threshold;
+}
+
+CopyEngine::~CopyEngine()
+{
+    WaitForAll();
+    Trim();
+}
+
+void CopyEngine::EnsureInitialized()
+{
+    if (m_spQueue)
+        return;
+
+    D3D12_COMMAND_QUEUE_DESC QueueDesc = {};
+    QueueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+    ComPtr<ID3D12CommandQueue> spQueue;
+    ComPtr<ID3D12Fence> spFence;
+    D3D12TranslationLayer::ThrowFailure(m_pDevice->CreateCommandQueue(&QueueDesc, IID_PPV_ARGS(&spQueue)));
+    D3D12TranslationLayer::ThrowFailure(m_pDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&spFence)));
+    m_spQueue = std::move(spQueue);
+    m_spFence = std::move(spFence);
+}
+
+// Whether the resource is the only user of a committed D3D12 resource. Suballocated buffers share
+// theirs with others, whose states and residency the translation layer tracks as a whole, and only
+// committed resources can be made resident on their own.
+static bool OwnsCommittedResource(D3D12TranslationLayer::Resource* pResource)
+{
+    return pResource->GetIdentity()->m_bOwnsUnderlyingResource &&
+        pResource->GetSubresourcePlacement(0).Offset == 0;
+}
+
+// Whether the CPU can't map the resource. The translation layer only waits for its own queue before
+// a map, so the CPU could otherwise see a mappable buffer before a copy into it has finished.
+static bool IsGPUOnly(D3D12TranslationLayer::Resource* pResource)
+{
+    D3D12_HEAP_PROPERTIES Properties;
+    if (FAILED(pResource->GetUnderlyingResource()->GetHeapProperties(&Properties, nullptr)))
+        return false;
+    return Properties.Type == D3D12_HEAP_TYPE_DEFAULT ||
+        (Properties.Type == D3D12_HEAP_TYPE_CUSTOM && Properties.CPUPageProperty == D3D12_CPU_PAGE_PROPERTY_NOT_AVAILABLE);
+}
+
+bool CopyEngine::CopyBufferRegion(D3D12TranslationLayer::ImmediateContext& ImmCtx,
+                                  D3D12TranslationLayer::Resource* pDst, UINT64 DstOffset,
+                                  D3D12TranslationLayer::Resource* pSrc, UINT64 SrcOffset,
+                                  UINT64 NumBytes)
+{
+    // A buffer can't be both the source and destination of a copy without an explicit state for it
+    UINT64 Threshold = GetThreshold();
+    if (Threshold == 0 || NumBytes < Threshold || pDst == pSrc ||
+        !OwnsCommittedResource(pDst) || !OwnsCommittedResource(pSrc) ||
+        !IsGPUOnly(pDst) || !IsGPUOnly(pSrc))
+        return false;
+
+    EnsureInitialized();
+
+    // The copy queue relies on buffers being promoted from the common state, which isn't possible
+    // for a resource that an earlier copy in the same batch already promoted
+    if (m_BatchResources.count(pDst) || m_BatchResources.count(pSrc))
+    {
+        SubmitBatch(ImmCtx);
+    }
+
+    ID3D12Pageable* Pageables[2] = { pDst->GetUnderlyingResource(), pSrc->GetUnderlyingResource() };
+    if (FAILED(m_pDevice->MakeResident(2, Pageables)))
+        return false;
+    auto EvictOnFailure = wil::scope_exit([&]() { (void)m_pDevice->Evict(2, Pageables); });
+
+    if (!m_spBatchAllocator)
+    {
+        ComPtr<ID3D12CommandAllocator> spAllocator;
+        UINT64 CompletedValue = m_spFence->GetCompletedValue();
+        auto Reusable = std::find_if(m_Allocators.begin(), m_Allocators.end(),
+                                     [CompletedValue](InFlightAllocator const& a) { return a.m_FenceValue <= CompletedValue; });
+        if (Reusable != m_Allocators.end())
+        {
+            spAllocator = Reusable->m_spAllocator;
+            D3D12TranslationLayer::ThrowFailure(spAllocator->Reset());
+            m_Allocators.erase(Reusable);
+        }
+        else
+        {
+            D3D12TranslationLayer::ThrowFailure(m_pDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&spAllocator)));
+        }
+
+        if (!m_spCommandList)
+        {
+            D3D12TranslationLayer::ThrowFailure(m_pDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, spAllocator.Get(), nullptr, IID_PPV_ARGS(&m_spCommandList)));
+        }
+        else
+        {
+            D3D12TranslationLayer::ThrowFailure(m_spCommandList->Reset(spAllocator.Get(), nullptr));
+        }
+        m_spBatchAllocator = std::move(spAllocator);
+    }
+
+    m_BatchResidency.reserve(m_BatchResidency.size() + 2);
+    m_BatchResources.insert(pDst);
+    m_BatchResources.insert(pSrc);
+    m_PendingResources.insert(pDst);
+    m_PendingResources.insert(pSrc);
+
+    // Hand both buffers over in the common state, the same way as for sharing them outside the
+    // translation layer. They decay back to it once the copy's batch completes, so the state
+    // tracker's view of them stays accurate without it knowing about this queue.
+    auto& StateManager = ImmCtx.GetResourceStateManager();
+    for (auto pResource : { pDst, pSrc })
+    {
+        StateManager.TransitionResource(pResource,
+                                        D3D12_RESOURCE_STATE_COMMON,
+                                        D3D12TranslationLayer::COMMAND_LIST_TYPE::GRAPHICS,
+                                        D3D12TranslationLayer::SubresourceTransitionFlags::StateMatchExact |
+                                            D3D12TranslationLayer::SubresourceTransitionFlags::ForceExclusiveState |
+                                            D3D12TranslationLayer::SubresourceTransitionFlags::NotUsedInCommandListIfNoStateChange);
+    }
+    StateManager.ApplyAllResourceTransitions();
+
+    // No more exceptions
+    m_spCommandList->CopyBufferRegion(pDst->GetUnderlyingResource(), DstOffset, pSrc->GetUnderlyingResource(), SrcOffset, NumBytes);
+    m_BatchResidency.emplace_back(Pageables[0]);
+    m_BatchResidency.emplace_back(Pageables[1]);
+    EvictOnFailure.release();
+    return true;
+}
+
+void CopyEngine::SubmitBatch(D3D12TranslationLayer::ImmediateContext& ImmCtx)
+{
+    if (!m_spBatchAllocator)
+        return;
+
+    m_Allocators.reserve(m_Allocators.size() + 1);
+    m_ResidentResources.reserve(m_ResidentResources.size() + m_BatchResidency.size());
+    D3D12TranslationLayer::ThrowFailure(m_spCommandList->Close());
+
+    // The batch starts once everything recorded on the immediate context so far has finished,
+    // including the transitions that handed its buffers over
+    ImmCtx.Flush(D3D12TranslationLayer::COMMAND_LIST_TYPE_GRAPHICS_MASK);
+    auto pImmCtxQueue = ImmCtx.GetCommandQueue(D3D12TranslationLayer::COMMAND_LIST_TYPE::GRAPHICS);
+    D3D12TranslationLayer::ThrowFailure(pImmCtxQueue->Signal(m_spFence.Get(), ++m_LastSignaled));
+    D3D12TranslationLayer::ThrowFailure(m_spQueue->Wait(m_spFence.Get(), m_LastSignaled));
+
+    ID3D12CommandList* pList = m_spCommandList.Get();
+    m_spQueue->ExecuteCommandLists(1, &pList);
+    D3D12TranslationLayer::ThrowFailure(m_spQueue->Signal(m_spFence.Get(), ++m_LastSignaled));
+
+    // No more exceptions
+    m_Allocators.push_back({ std::move(m_spBatchAllocator), m_LastSignaled });
+    for (auto& spPageable : m_BatchResidency)
+    {
+        m_ResidentResources.push_back({ std::move(spPageable), m_LastSignaled });
+    }
+    m_BatchResidency.clear();
+    m_BatchResources.clear();
+    m_PendingFenceValue = m_LastSignaled;
+}
+
+void CopyEngine::MakeImmCtxWait(D3D12TranslationLayer::ImmediateContext& ImmCtx)
+{
+    SubmitBatch(ImmCtx);
+
+    // Work recorded so far doesn't need to wait, so submit it before the wait goes on the queue
+    ImmCtx.Flush(D3D12TranslationLayer::COMMAND_LIST_TYPE_GRAPHICS_MASK);
+    auto pImmCtxQueue = ImmCtx.GetCommandQueue(D3D12TranslationLayer::COMMAND_LIST_TYPE::GRAPHICS);
+    D3D12TranslationLayer::ThrowFailure(pImmCtxQueue->Wait(m_spFence.Get(), m_PendingFenceValue));
+    m_PendingFenceValue = 0;
+    m_PendingResources.clear();
+}
+
+void CopyEngine::SyncBeforeTasks(D3D12TranslationLayer::ImmediateContext& ImmCtx, Submission& tasks, size_t Begin, size_t End)
+{
+    if (m_PendingResources.empty())
+        return;
+
+    std::vector<Task::ResourceUsage> Usage;
+    for (size_t i = Begin; i < End; ++i)
+    {
+        Usage.clear();
+        if (!tasks[i]->GetResourceUsage(Usage) ||
+            std::any_of(Usage.begin(), Usage.end(), [this](Task::ResourceUsage const& u) { return m_PendingResources.count(u.m_Resource) != 0; }))
+        {
+            MakeImmCtxWait(ImmCtx);
+            return;
+        }
+    }
+
+    // Nothing in this run waits for the batch, so it can run alongside it
+    SubmitBatch(ImmCtx);
+}
+
+void CopyEngine::SyncAll(D3D12TranslationLayer::ImmediateContext& ImmCtx)
+{
+    if (!m_PendingResources.empty())
+    {
+        MakeImmCtxWait(ImmCtx);
+    }
+}
+
+void CopyEngine::WaitForAll() noexcept
+{
+    // A batch that couldn't be submitted is dropped, along with the residency it was holding
+    if (m_spBatchAllocator)
+    {
+        (void)m_spCommandList->Close();
+        for (auto& spPageable : m_BatchResidency)
+        {
+            ID3D12Pageable* pPageable = spPageable.Get();
+            (void)m_pDevice->Evict(1, &pPageable);
+        }
+        m_BatchResidency.clear();
+        m_BatchResources.clear();
+        m_spBatchAllocator.Reset();
+    }
+
+    WaitFor(m_LastSignaled);
+    m_PendingFenceValue = 0;
+    m_PendingResources.clear();
+}
+
+void CopyEngine::WaitFor(UINT64 FenceValue) noexcept
+{
+    if (m_spFence && m_spFence->GetCompletedValue() < FenceValue)
+    {
+        // A null event blocks until the fence reaches the value
+        (void)m_spFence->SetEventOnCompletion(FenceValue, nullptr);
+    }
+}
+
+void CopyEngine::Trim() noexcept
+{
+    if (m_ResidentResources.empty())
+        return;
+
+    UINT64 CompletedValue = m_spFence->GetCompletedValue();
+    auto Done = std::partition(m_ResidentResources.begin(), m_ResidentResources.end(),
+                               [CompletedValue](ResidencyReference const& r) { return r.m_FenceValue > CompletedValue; });
+    for (auto iter = Done; iter != m_ResidentResources.end(); ++iter)
+    {
+        ID3D12Pageable* pPageable = iter->m_spPageable.Get();
+        (void)m_pDevice->Evict(1, &pPageable);
+    }
+    m_ResidentResources.erase(Done, m_ResidentResources.end());
+}
@@ -6,6 +6,7 @@
 
 #include <wil/resource.h>
 #include <directx/d3d12compatibility.h>
+#include <unordered_map>
 
 extern CL_API_ENTRY cl_int CL_API_CALL
 clGetDeviceIDs(cl_platform_id   platform,
@@ -220,9 +221,11 @@ clGetDeviceInfo(cl_device_id    device,
                                                    "cl_khr_3d_image_writes "
                                                    "cl_khr_gl_sharing "
                                                    "cl_khr_gl_event "
+                                                   "cl_arm_printf "
+                                                   "cl_msft_set_kernel_args "
         );
 
-        case CL_DEVICE_PRINTF_BUFFER_SIZE: return RetValue((size_t)1024 * 1024);
+        case CL_DEVICE_PRINTF_BUFFER_SIZE: return RetValue((size_t)g_Platform->GetPrintfBufferSize());
         case CL_DEVICE_PREFERRED_INTEROP_USER_SYNC: return RetValue((cl_bool)CL_TRUE);
 
         case CL_DEVICE_PARENT_DEVICE: return RetValue((cl_device_id)nullptr);
@@ -298,6 +301,9 @@ static D3D12TranslationLayer::TranslationLayerCallbacks GetImmCtxCallbacks()
     return Callbacks;
 }
 
+// Kernels are dispatched on the immediate context's GRAPHICS queue, which is a direct queue unless the
+// device is compute-only. Moving dispatch to a dedicated compute queue is deferred: the immediate context
+// picks its own command list type, and a second context would need its own copy of every resource.
 D3DDevice::D3DDevice(Device &parent, ID3D12Device *pDevice, ID3D12CommandQueue *pQueue,
                      D3D12_FEATURE_DATA_D3D12_OPTIONS &options, bool IsImportedDevice)
     : m_IsImportedDevice(IsImportedDevice)
@@ -306,7 +312,7 @@ D3DDevice::D3DDevice(Device &parent, ID3D12Device *pDevice, ID3D12CommandQueue *
     , m_Callbacks(GetImmCtxCallbacks())
     , m_ImmCtx(0, options, pDevice, pQueue, m_Callbacks, 0, GetImmCtxCreationArgs())
     , m_RecordingSubmission(new Submission)
-    , m_ShaderCache(pDevice)
+    , m_ShaderCache(pDevice, parent.GetHardwareIds().vendorID, parent.GetHardwareIds().deviceID)
 {
     BackgroundTaskScheduler::SchedulingMode mode{ 1u, BackgroundTaskScheduler::Priority::Normal };
     m_CompletionScheduler.SetSchedulingMode(mode);
@@ -365,6 +371,14 @@ void Device::ReleaseD3D(D3DDevice &device)
 
     g_Platform->DeviceUninit();
 
+    auto& Stats = device.m_SubmissionStats;
+    TraceLoggingWrite(g_hOpenCLOn12Provider,
+                      "SubmissionStats",
+                      TraceLoggingPointer(&device, "Device"),
+                      TraceLoggingUInt64(Stats.m_Submissions.load(), "Submissions"),
+                      TraceLoggingUInt64(Stats.m_Tasks.load(), "Tasks"),
+                      TraceLoggingUInt64(Stats.m_CoalescedFlushes.load(), "CoalescedFlushes"));
+
     auto newEnd = std::remove_if(m_D3DDevices.begin(), m_D3DDevices.end(),
                                  [&device](D3DDevice *found) { return found == &device; });
     assert(std::distance(newEnd, m_D3DDevices.end()) == 1);
@@ -438,6 +452,16 @@ bool Device::SupportsInt16()
     return m_D3D12Options4.Native16BitShaderOpsSupported;
 }
 
+uint32_t Device::GetWaveWidth()
+{
+    if (uint32_t WaveWidth = m_WaveWidth.load(std::memory_order_acquire))
+        return WaveWidth;
+
+    std::lock_guard Lock(m_InitLock);
+    CacheCaps(Lock);
+    return m_WaveWidth.load(std::memory_order_relaxed);
+}
+
 bool Device::SupportsTypedUAVLoad()
 {
     {
@@ -513,35 +537,94 @@ void D3DDevice::ReadyTask(Task* task, TaskPoolLock const& lock)
     task->Ready(lock);
 }
 
-void D3DDevice::Flush(TaskPoolLock const&)
+size_t D3DDevice::GetMaxTasksPerSubmission()
 {
-    if (m_RecordingSubmission->empty())
+    static const size_t s_MaxTasks = []()
     {
-        return;
-    }
+        // Large enough to amortize the cost of a submission, small enough that the first tasks in
+        // a long stream don't wait too long to be reported complete
+        size_t maxTasks = 256;
+        char *maxTasksStr = nullptr;
+        if (_dupenv_s(&maxTasksStr, nullptr, "CLON12_MAX_TASKS_PER_SUBMISSION") == 0 && maxTasksStr)
+        {
+            maxTasks = std::max<size_t>(strtoul(maxTasksStr, nullptr, 0), 1);
+        }
+        free(maxTasksStr);
+        return maxTasks;
+    }();
+    return s_MaxTasks;
+}
 
+void D3DDevice::QueueExecution(std::unique_ptr<Submission> tasks)
+{
     struct ExecutionHandler
     {
         D3DDevice& m_Device;
         std::unique_ptr<Submission> m_Tasks;
+
+        // Once an execution starts, later flushes can't add to it anymore. It's no longer queued
+        // if the execution before it already took its tasks.
+        void Dequeue()
+        {
+            auto Lock = g_Platform->GetTaskPoolLock();
+            auto& Queued = m_Device.m_QueuedExecutions;
+            if (!Queued.empty() && Queued.front() == m_Tasks.get())
+                Queued.pop_front();
+        }
     };
-    std::unique_ptr<ExecutionHandler> spHandler(new ExecutionHandler{ *this, std::move(m_RecordingSubmission) });
+    std::unique_ptr<ExecutionHandler> spHandler(new ExecutionHandler{ *this, std::move(tasks) });
 
+    m_QueuedExecutions.push_back(spHandler->m_Tasks.get());
+    auto Unqueue = wil::scope_exit([&]() { m_QueuedExecutions.pop_back(); });
     m_CompletionScheduler.QueueTask({
         [](void* pContext)
         {
             std::unique_ptr<ExecutionHandler> spHandler(static_cast<ExecutionHandler*>(pContext));
+            spHandler->Dequeue();
             spHandler->m_Device.ExecuteTasks(*spHandler->m_Tasks);
         },
         [](void* pContext)
         {
+            // Only cancelled when the device is going away, at which point nothing flushes to it anymore
             std::unique_ptr<ExecutionHandler> spHandler(static_cast<ExecutionHandler*>(pContext));
         },
         spHandler.get()
     });
+    Unqueue.release();
     spHandler.release();
+}
+
+void D3DDevice::Flush(TaskPoolLock const&)
+{
+    if (m_RecordingSubmission->empty())
+    {
+        return;
+    }
+
+    const size_t MaxTasks = GetMaxTasksPerSubmission();
+    auto Remaining = std::make_move_iterator(m_RecordingSubmission->begin());
+    auto End = std::make_move_iterator(m_RecordingSubmission->end());
 
-    m_RecordingSubmission.reset(new Submission);
+    // While an execution is waiting for the previous one to finish, flushes add to it instead of
+    // queueing up more small executions behind it
+    if (!m_QueuedExecutions.empty() && m_QueuedExecutions.back()->size() < MaxTasks)
+    {
+        auto Queued = m_QueuedExecutions.back();
+        size_t Count = std::min<size_t>(MaxTasks - Queued->size(), End - Remaining);
+        Queued->insert(Queued->end(), Remaining, Remaining + Count);
+        Remaining += Count;
+        ++m_SubmissionStats.m_CoalescedFlushes;
+    }
+
+    // Long streams of work are split up, so that earlier tasks complete without waiting for later ones
+    while (Remaining != End)
+    {
+        size_t Count = std::min<size_t>(MaxTasks, End - Remaining);
+        QueueExecution(std::make_unique<Submission>(Remaining, Remaining + Count));
+        Remaining += Count;
+    }
+
+    m_RecordingSubmission->clear();
 }
 
 void Device::FlushAllDevices(TaskPoolLock const& Lock)
@@ -553,18 +636,233 @@ void Device::FlushAllDevices(TaskPoolLock const& Lock)
     }
 }
 
+// PSOs aren't persisted. Only the DXIL they're built from comes from the shader cache on a warm start.
+// The translation layer's PipelineState builds its root signature and PSO internally and has no way to
+// take a cached blob or a pipeline library, so reusing PSOs across runs is left as follow-up work.
 std::unique_ptr<D3D12TranslationLayer::PipelineState> D3DDevice::CreatePSO(D3D12TranslationLayer::COMPUTE_PIPELINE_STATE_DESC const& Desc)
 {
     std::lock_guard PSOCreateLock(m_PSOCreateLock);
     return std::make_unique<D3D12TranslationLayer::PipelineState>(&ImmCtx(), Desc);
 }
 
+auto D3DDevice::AcquirePrintfBuffer(uint32_t Size) -> std::unique_ptr<PrintfBuffer>
+{
+    {
+        std::lock_guard PoolLock(m_PrintfBufferLock);
+        if (auto iter = m_PrintfBufferPool.find(Size); iter != m_PrintfBufferPool.end())
+        {
+            auto Buffer = std::move(iter->second);
+            m_PrintfBufferPool.erase(iter);
+            return Buffer;
+        }
+    }
+
+    // Same properties as a CL_MEM_ALLOC_HOST_PTR buffer, so the results can be mapped directly for reading
+    D3D12TranslationLayer::ResourceCreationArgs Args = {};
+    Args.m_bManageResidency = true;
+    Args.m_appDesc.m_Subresources = 1;
+    Args.m_appDesc.m_SubresourcesPerPlane = 1;
+    Args.m_appDesc.m_NonOpaquePlaneCount = 1;
+    Args.m_appDesc.m_MipLevels = 1;
+    Args.m_appDesc.m_ArraySize = 1;
+    Args.m_appDesc.m_Depth = 1;
+    Args.m_appDesc.m_Width = Size;
+    Args.m_appDesc.m_Height = 1;
+    Args.m_appDesc.m_Format = DXGI_FORMAT_UNKNOWN;
+    Args.m_appDesc.m_Samples = 1;
+    Args.m_appDesc.m_Quality = 0;
+    Args.m_appDesc.m_resourceDimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+    Args.m_appDesc.m_usage = D3D12TranslationLayer::RESOURCE_USAGE_DEFAULT;
+    Args.m_appDesc.m_bindFlags = D3D12TranslationLayer::RESOURCE_BIND_UNORDERED_ACCESS;
+    Args.m_appDesc.m_cpuAcess = D3D12TranslationLayer::RESOURCE_CPU_ACCESS_READ | D3D12TranslationLayer::RESOURCE_CPU_ACCESS_WRITE;
+    Args.m_desc12 = CD3DX12_RESOURCE_DESC::Buffer(Size, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+    Args.m_heapDesc = CD3DX12_HEAP_DESC(0, D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_FLAG_CREATE_NOT_RESIDENT);
+    Args.m_heapDesc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_CPU_PAGE_PROPERTY_WRITE_COMBINE, D3D12_MEMORY_POOL_L0);
+
+    auto Buffer = std::make_unique<PrintfBuffer>();
+    Buffer->m_Size = Size;
+    Buffer->m_Resource = D3D12TranslationLayer::Resource::CreateResource(&ImmCtx(), Args,
+        D3D12TranslationLayer::ResourceAllocationContext::FreeThread);
+
+    D3D12TranslationLayer::D3D12_UNORDERED_ACCESS_VIEW_DESC_WRAPPER UAVDescWrapper = {};
+    auto& UAVDesc = UAVDescWrapper.m_Desc12;
+    UAVDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+    UAVDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    UAVDesc.Buffer.CounterOffsetInBytes = 0;
+    UAVDesc.Buffer.StructureByteStride = 0;
+    UAVDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_RAW;
+    UAVDesc.Buffer.FirstElement = 0;
+    UAVDesc.Buffer.NumElements = Size / 4;
+    UAVDescWrapper.m_D3D11UAVFlags = D3D11_BUFFER_UAV_FLAG_RAW;
+    Buffer->m_UAV = std::make_unique<D3D12TranslationLayer::UAV>(&ImmCtx(), UAVDescWrapper, *Buffer->m_Resource.get());
+    return Buffer;
+}
+
+void D3DDevice::ReturnPrintfBuffer(std::unique_ptr<PrintfBuffer> buffer) noexcept
+{
+    // Enough to cover a handful of printf-using kernels in flight at once,
+    // without pinning unbounded memory if an app bursts a lot of them.
+    constexpr size_t MaxPooledPrintfBuffers = 8;
+    if (!buffer)
+        return;
+
+    // Buffers that don't make it into the pool are freed once the lock is released
+    std::unique_ptr<PrintfBuffer> Evicted;
+    std::lock_guard PoolLock(m_PrintfBufferLock);
+    if (m_PrintfBufferPool.size() >= MaxPooledPrintfBuffers)
+    {
+        // Make room by dropping a buffer of another size, since this one's size is the most recently used
+        auto Victim = std::find_if(m_PrintfBufferPool.begin(), m_PrintfBufferPool.end(),
+                                   [Size = buffer->m_Size](auto const& Entry) { return Entry.first != Size; });
+        if (Victim == m_PrintfBufferPool.end())
+            return;
+        Evicted = std::move(Victim->second);
+        m_PrintfBufferPool.erase(Victim);
+    }
+    try
+    {
+        m_PrintfBufferPool.emplace(buffer->m_Size, std::move(buffer));
+    }
+    catch (std::bad_alloc&) {}
+}
+
+// Finds the run of tasks starting at Start whose resource usage is fully known and doesn't conflict:
+// no resource is written by one task and used by another, and every use of a resource needs the
+// same state. Since the tasks in the run can't observe each other's accesses, it doesn't matter
+// what order they're in, so all of the run's transitions are issued as one batch up front rather
+// than separately before each dispatch. Returns the end of the run.
+//
+// Only transitions are batched. The run's write sets are disjoint, but UAV barriers between its
+// dispatches are still inserted by the translation layer, which this can't turn off. A task that
+// can't describe its resource usage ends the run, so hazards aren't tracked across the whole
+// submission either.
+static size_t TransitionIndependentRun(ImmCtx& ImmCtx, CopyEngine& Copies, Submission& tasks, size_t Start)
+{
+    struct MergedUsage
+    {
+        D3D12_RESOURCE_STATES m_State;
+        bool m_Written;
+        // Used in different states by a single task, which the translation layer has to sort out
+        bool m_Mixed;
+    };
+    std::unordered_map<D3D12TranslationLayer::Resource*, MergedUsage> RunUsage, TaskUsage;
+    std::vector<Task::ResourceUsage> Usage;
+    size_t End = Start;
+    size_t NumTasksWithUsage = 0;
+    for (; End < tasks.size(); ++End)
+    {
+        Usage.clear();
+        if (!tasks[End]->GetResourceUsage(Usage))
+            break;
+
+        TaskUsage.clear();
+        for (auto& u : Usage)
+        {
+            auto [iter, inserted] = TaskUsage.try_emplace(u.m_Resource, MergedUsage{ u.m_State, u.m_Written, false });
+            if (!inserted)
+            {
+                iter->second.m_Written |= u.m_Written;
+                iter->second.m_Mixed |= iter->second.m_State != u.m_State;
+            }
+        }
+
+        bool Conflict = std::any_of(TaskUsage.begin(), TaskUsage.end(), [&RunUsage](auto const& u)
+        {
+            auto iter = RunUsage.find(u.first);
+            return iter != RunUsage.end() &&
+                (iter->second.m_Written || u.second.m_Written || iter->second.m_Mixed || u.second.m_Mixed ||
+                 iter->second.m_State != u.second.m_State);
+        });
+        if (Conflict)
+            break;
+
+        RunUsage.insert(TaskUsage.begin(), TaskUsage.end());
+        NumTasksWithUsage += TaskUsage.empty() ? 0 : 1;
+    }
+
+    // Copies on the copy queue have to finish before anything in the run sees them, including these transitions
+    Copies.SyncBeforeTasks(ImmCtx, tasks, Start, std::max(End, Start + 1));
+
+    // With a single task, this is exactly what the translation layer would do before its dispatch
+    if (NumTasksWithUsage > 1)
+    {
+        auto& StateManager = ImmCtx.GetResourceStateManager();
+        for (auto& [Res, u] : RunUsage)
+        {
+            if (!u.m_Mixed)
+                StateManager.TransitionResource(Res, u.m_State);
+        }
+        StateManager.ApplyAllResourceTransitions();
+    }
+    return End;
+}
+
 void D3DDevice::ExecuteTasks(Submission& tasks)
 {
+    // Taken by the execution before this one
+    if (tasks.empty())
+        return;
+
+    // The next queued execution is recorded and submitted before waiting for the current one, so
+    // that the GPU has work queued up while this thread waits and then completes tasks
+    Submission Current = std::move(tasks);
+    RecordedFences Fences = RecordTasks(Current);
+    for (;;)
+    {
+        Submission Next;
+        {
+            auto Lock = g_Platform->GetTaskPoolLock();
+            if (!m_QueuedExecutions.empty())
+            {
+                Next.swap(*m_QueuedExecutions.front());
+                m_QueuedExecutions.pop_front();
+            }
+        }
+        bool HasNext = !Next.empty();
+        RecordedFences NextFences = HasNext ? RecordTasks(Next) : RecordedFences{};
+
+        ImmCtx().WaitForFenceValue(D3D12TranslationLayer::COMMAND_LIST_TYPE::GRAPHICS, Fences.m_ImmCtx);
+        m_CopyEngine.WaitFor(Fences.m_CopyQueue);
+        m_CopyEngine.Trim();
+
+        {
+            auto Lock = g_Platform->GetTaskPoolLock();
+            for (auto& task : Current)
+            {
+                task->Complete(CL_SUCCESS, Lock);
+            }
+
+            // Enqueue another execution task if there's new items ready to go
+            g_Platform->FlushAllDevices(Lock);
+        }
+
+        if (!HasNext)
+            break;
+        Current = std::move(Next);
+        Fences = NextFences;
+    }
+}
+
+D3DDevice::RecordedFences D3DDevice::RecordTasks(Submission& tasks)
+{
+    uint64_t SubmissionIndex = ++m_SubmissionStats.m_Submissions;
+    m_SubmissionStats.m_Tasks += tasks.size();
+    TraceLoggingWrite(g_hOpenCLOn12Provider,
+                      "Submission",
+                      TraceLoggingPointer(this, "Device"),
+                      TraceLoggingUInt64(SubmissionIndex, "Index"),
+                      TraceLoggingUInt64(tasks.size(), "NumTasks"));
+
+    size_t RunEnd = 0;
     for (cl_uint i = 0; i < tasks.size(); ++i)
     {
         try
         {
+            if (i >= RunEnd)
+            {
+                RunEnd = std::max<size_t>(i + 1, TransitionIndependentRun(ImmCtx(), m_CopyEngine, tasks, i));
+            }
+
             auto& task = tasks[i];
             task->Record();
             auto Lock = g_Platform->GetTaskPoolLock();
@@ -572,6 +870,10 @@ void D3DDevice::ExecuteTasks(Submission& tasks)
         }
         catch (...)
         {
+            // The failed task may have bound part of its state without it being tracked
+            ImmCtx().ClearState();
+            m_ComputeViewState.Reset();
+
             auto Lock = g_Platform->GetTaskPoolLock();
             if ((cl_int)tasks[i]->GetState() > 0)
             {
@@ -586,18 +888,29 @@ void D3DDevice::ExecuteTasks(Submission& tasks)
         }
     }
 
-    ImmCtx().WaitForCompletion(D3D12TranslationLayer::COMMAND_LIST_TYPE::GRAPHICS);
-
+    // Kernels leave their bindings in place so that the next one can reuse them. Unbind everything
+    // before the tasks complete and release what was bound. Submissions without kernels have nothing
+    // to clear.
+    if (m_ComputeViewState.HasBindings())
     {
-        auto Lock = g_Platform->GetTaskPoolLock();
-        for (auto& task : tasks)
-        {
-            task->Complete(CL_SUCCESS, Lock);
-        }
+        ImmCtx().ClearState();
+        m_ComputeViewState.Reset();
+    }
 
-        // Enqueue another execution task if there's new items ready to go
-        g_Platform->FlushAllDevices(Lock);
+    try
+    {
+        m_CopyEngine.SyncAll(ImmCtx());
+    }
+    catch (...)
+    {
+        // The queue can't be made to wait, so wait for the copies here instead
+        m_CopyEngine.WaitForAll();
     }
+    ImmCtx().Flush(D3D12TranslationLayer::COMMAND_LIST_TYPE_GRAPHICS_MASK);
+    // The last command list submitted, or one before it if these tasks didn't record anything. That
+    // can precede the queue's wait for the copies, so those are tracked separately.
+    return { ImmCtx().GetCommandListID(D3D12TranslationLayer::COMMAND_LIST_TYPE::GRAPHICS) - 1,
+             m_CopyEngine.GetLastSubmitted() };
 }
 
 void Device::CacheCaps(std::lock_guard<std::mutex> const&, ComPtr<ID3D12Device> spDevice)
@@ -611,7 +924,10 @@ void Device::CacheCaps(std::lock_guard<std::mutex> const&, ComPtr<ID3D12Device>
     }
     spDevice->CheckFeatureSupport(D3D12_FEATURE_ARCHITECTURE, &m_Architecture, sizeof(m_Architecture));
     spDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &m_D3D12Options, sizeof(m_D3D12Options));
+    spDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS1, &m_D3D12Options1, sizeof(m_D3D12Options1));
     spDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS4, &m_D3D12Options4, sizeof(m_D3D12Options4));
+    // Drivers without wave op support don't report a lane count
+    m_WaveWidth.store(m_D3D12Options1.WaveLaneCountMin ? m_D3D12Options1.WaveLaneCountMin : 32, std::memory_order_release);
 
     D3D_SHADER_MODEL SMTests[] = {
         D3D_SHADER_MODEL_6_7, D3D_SHADER_MODEL_6_6, D3D_SHADER_MODEL_6_5,
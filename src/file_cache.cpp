@@ -0,0 +1,526 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#include "file_cache.hpp"
+
+// Only the standard library and the OS, so that this can be built and tested on its own
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr uint32_t FormatVersion = 1;
+    constexpr char FileMagic[8] = { 'C', 'L', 'O', 'N', '1', '2', 'S', 'C' };
+    constexpr uint32_t EntryMagic = 0x45544e45; // 'ENTE'
+
+    struct FileHeader
+    {
+        char Magic[8];
+        uint32_t FormatVersion;
+        uint32_t HeaderSize;
+        uint64_t CacheVersion;
+        uint64_t Checksum;
+    };
+
+    // Followed by the key, the value, and padding up to 8 bytes
+    struct EntryHeader
+    {
+        uint32_t Magic;
+        uint32_t KeySize;
+        uint64_t ValueSize;
+        // Covers the fields above, the key and the value
+        uint64_t Checksum;
+    };
+
+    // FNV-1a, continued across several pieces
+    uint64_t Checksum(uint64_t hash, const void* data, size_t size) noexcept
+    {
+        auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+    constexpr uint64_t ChecksumSeed = 0xcbf29ce484222325ull;
+
+    uint64_t HeaderChecksum(FileHeader const& header) noexcept
+    {
+        return Checksum(ChecksumSeed, &header, offsetof(FileHeader, Checksum));
+    }
+
+    uint64_t EntryChecksum(EntryHeader const& header, const void* key, const void* value) noexcept
+    {
+        uint64_t hash = Checksum(ChecksumSeed, &header, offsetof(EntryHeader, Checksum));
+        hash = Checksum(hash, key, header.KeySize);
+        return Checksum(hash, value, (size_t)header.ValueSize);
+    }
+
+    uint64_t EntrySize(uint64_t KeySize, uint64_t ValueSize) noexcept
+    {
+        return (sizeof(EntryHeader) + KeySize + ValueSize + 7) & ~7ull;
+    }
+
+    // Runs a function when it goes out of scope, unless released first
+    template <typename Fn>
+    class ScopeExit
+    {
+    public:
+        explicit ScopeExit(Fn fn) : m_Fn(std::move(fn)) {}
+        ~ScopeExit() { if (m_Active) m_Fn(); }
+        ScopeExit(ScopeExit const&) = delete;
+        ScopeExit& operator=(ScopeExit const&) = delete;
+        void release() noexcept { m_Active = false; }
+
+    private:
+        Fn m_Fn;
+        bool m_Active = true;
+    };
+}
+
+class FileCache::File
+{
+public:
+    ~File() { Close(); }
+
+    // Fails if another process has the file open
+    bool Open(std::string const& Path) noexcept
+    {
+#ifdef _WIN32
+        HANDLE hFile = CreateFileA(Path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER Size;
+        if (!GetFileSizeEx(hFile, &Size))
+        {
+            CloseHandle(hFile);
+            return false;
+        }
+        m_hFile = hFile;
+        m_Size = Size.QuadPart;
+#else
+        int fd = open(Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        m_FD = fd;
+        m_Size = st.st_size;
+#endif
+        return true;
+    }
+
+    void Close() noexcept
+    {
+        Unmap();
+#ifdef _WIN32
+        if (m_hFile)
+            CloseHandle(m_hFile);
+        m_hFile = nullptr;
+#else
+        if (m_FD >= 0)
+            close(m_FD);
+        m_FD = -1;
+#endif
+    }
+
+    // Size when the file was opened
+    uint64_t GetSize() const noexcept { return m_Size; }
+
+    bool WriteAt(uint64_t Offset, const void* Data, size_t Size) noexcept
+    {
+        auto pBytes = static_cast<const char*>(Data);
+        while (Size)
+        {
+#ifdef _WIN32
+            OVERLAPPED Overlapped = {};
+            Overlapped.Offset = (DWORD)Offset;
+            Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+            DWORD Written = 0;
+            if (!WriteFile(m_hFile, pBytes, (DWORD)std::min<size_t>(Size, 1u << 30), &Written, &Overlapped) || Written == 0)
+                return false;
+#else
+            ssize_t Written = pwrite(m_FD, pBytes, Size, (off_t)Offset);
+            if (Written <= 0)
+                return false;
+#endif
+            pBytes += Written;
+            Offset += Written;
+            Size -= Written;
+        }
+        return true;
+    }
+
+    // The file must not be mapped
+    bool Truncate(uint64_t Size) noexcept
+    {
+        assert(!m_pMapped);
+#ifdef _WIN32
+        LARGE_INTEGER Position;
+        Position.QuadPart = Size;
+        return SetFilePointerEx(m_hFile, Position, nullptr, FILE_BEGIN) && SetEndOfFile(m_hFile);
+#else
+        return ftruncate(m_FD, (off_t)Size) == 0;
+#endif
+    }
+
+    void Flush() noexcept
+    {
+#ifdef _WIN32
+        (void)FlushFileBuffers(m_hFile);
+#else
+        (void)fsync(m_FD);
+#endif
+    }
+
+    bool Map(uint64_t Size) noexcept
+    {
+        Unmap();
+        if (Size == 0)
+            return true;
+#ifdef _WIN32
+        m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_hMapping)
+            return false;
+        m_pMapped = static_cast<const unsigned char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        void* pMapped = mmap(nullptr, (size_t)Size, PROT_READ, MAP_SHARED, m_FD, 0);
+        m_pMapped = pMapped == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(pMapped);
+#endif
+        if (!m_pMapped)
+        {
+            Unmap();
+            return false;
+        }
+        m_MappedSize = Size;
+        return true;
+    }
+
+    void Unmap() noexcept
+    {
+#ifdef _WIN32
+        if (m_pMapped)
+            UnmapViewOfFile(m_pMapped);
+        if (m_hMapping)
+            CloseHandle(m_hMapping);
+        m_hMapping = nullptr;
+#else
+        if (m_pMapped)
+            munmap(const_cast<unsigned char*>(m_pMapped), (size_t)m_MappedSize);
+#endif
+        m_pMapped = nullptr;
+        m_MappedSize = 0;
+    }
+
+    const unsigned char* GetMapped() const noexcept { return m_pMapped; }
+    uint64_t GetMappedSize() const noexcept { return m_MappedSize; }
+
+private:
+#ifdef _WIN32
+    HANDLE m_hFile = nullptr;
+    HANDLE m_hMapping = nullptr;
+#else
+    int m_FD = -1;
+#endif
+    uint64_t m_Size = 0;
+    const unsigned char* m_pMapped = nullptr;
+    uint64_t m_MappedSize = 0;
+};
+
+std::shared_ptr<FileCache> FileCache::Open(std::string const& Directory, std::string const& Name,
+                                           uint64_t Version, uint64_t MaxSize)
+{
+    if (Directory.empty() || MaxSize <= sizeof(FileHeader))
+        return nullptr;
+
+    std::error_code ec;
+    std::filesystem::create_directories(Directory, ec);
+    std::string Path = (std::filesystem::path(Directory) / Name).string();
+
+    // Several devices can share a file, but a process can only open it once
+    static std::mutex s_Lock;
+    static std::unordered_map<std::string, std::weak_ptr<FileCache>> s_Open;
+    std::lock_guard lock(s_Lock);
+    if (auto iter = s_Open.find(Path); iter != s_Open.end())
+    {
+        if (auto spExisting = iter->second.lock())
+            return spExisting->m_Version == Version ? spExisting : nullptr;
+    }
+
+    std::shared_ptr<FileCache> spCache(new FileCache(Path, Version, MaxSize));
+    if (!spCache->m_File->Open(Path) || !spCache->Load())
+        return nullptr;
+    s_Open[Path] = spCache;
+    return spCache;
+}
+
+std::string FileCache::GetDefaultDirectory()
+{
+    std::string Directory;
+#ifdef _WIN32
+    char *localAppData = nullptr;
+    if (_dupenv_s(&localAppData, nullptr, "LOCALAPPDATA") == 0 && localAppData)
+    {
+        Directory = (std::filesystem::path(localAppData) / "OpenCLOn12" / "ShaderCache").string();
+    }
+    free(localAppData);
+#else
+    if (const char* xdgCache = getenv("XDG_CACHE_HOME"); xdgCache && *xdgCache)
+        Directory = (std::filesystem::path(xdgCache) / "openclon12").string();
+    else if (const char* home = getenv("HOME"); home && *home)
+        Directory = (std::filesystem::path(home) / ".cache" / "openclon12").string();
+#endif
+    return Directory;
+}
+
+FileCache::FileCache(std::string Path, uint64_t Version, uint64_t MaxSize)
+    : m_Path(std::move(Path))
+    , m_Version(Version)
+    , m_MaxSize(MaxSize)
+    , m_File(new File)
+{
+}
+
+FileCache::~FileCache() = default;
+
+bool FileCache::Load()
+{
+    m_Index.clear();
+    m_FileSize = m_File->GetSize();
+    if (!m_File->Map(m_FileSize))
+        return false;
+
+    const unsigned char* pData = m_File->GetMapped();
+    FileHeader Header = {};
+    if (m_FileSize >= sizeof(Header))
+        memcpy(&Header, pData, sizeof(Header));
+
+    uint64_t ValidSize = 0;
+    if (memcmp(Header.Magic, FileMagic, sizeof(FileMagic)) == 0 &&
+        Header.FormatVersion == FormatVersion &&
+        Header.HeaderSize == sizeof(Header) &&
+        Header.CacheVersion == m_Version &&
+        Header.Checksum == HeaderChecksum(Header))
+    {
+        ValidSize = sizeof(Header);
+        while (m_FileSize - ValidSize >= sizeof(EntryHeader))
+        {
+            EntryHeader Entry;
+            memcpy(&Entry, pData + ValidSize, sizeof(Entry));
+            uint64_t Remaining = m_FileSize - ValidSize;
+            if (Entry.Magic != EntryMagic ||
+                Entry.ValueSize > Remaining ||
+                EntrySize(Entry.KeySize, Entry.ValueSize) > Remaining)
+                break;
+
+            auto pKey = pData + ValidSize + sizeof(Entry);
+            auto pValue = pKey + Entry.KeySize;
+            if (Entry.Checksum != EntryChecksum(Entry, pKey, pValue))
+                break;
+
+            // Later entries for the same key replace earlier ones
+            m_Index[std::string(reinterpret_cast<const char*>(pKey), Entry.KeySize)] =
+                { (uint64_t)(pValue - pData), Entry.ValueSize, ++m_UseCounter };
+            ValidSize += EntrySize(Entry.KeySize, Entry.ValueSize);
+        }
+    }
+
+    if (ValidSize == m_FileSize && ValidSize != 0)
+        return true;
+
+    // Whatever follows the last valid entry was cut short, or the whole file is new or from another version
+    m_File->Unmap();
+    if (!m_File->Truncate(ValidSize))
+        return false;
+    m_FileSize = ValidSize;
+
+    if (ValidSize == 0)
+    {
+        m_Index.clear();
+        Header = {};
+        memcpy(Header.Magic, FileMagic, sizeof(FileMagic));
+        Header.FormatVersion = FormatVersion;
+        Header.HeaderSize = sizeof(Header);
+        Header.CacheVersion = m_Version;
+        Header.Checksum = HeaderChecksum(Header);
+        if (!m_File->WriteAt(0, &Header, sizeof(Header)))
+            return false;
+        m_FileSize = sizeof(Header);
+    }
+    return m_File->Map(m_FileSize);
+}
+
+bool FileCache::EnsureMapped(uint64_t End)
+{
+    if (End <= m_File->GetMappedSize())
+        return true;
+    return m_File->Map(m_FileSize);
+}
+
+FileCache::FoundValue FileCache::Find(std::string_view Key)
+{
+    std::lock_guard lock(m_Lock);
+    if (!m_File)
+        return {};
+
+    auto iter = m_Index.find(std::string(Key));
+    if (iter == m_Index.end())
+        return {};
+
+    IndexEntry& Entry = iter->second;
+    if (!EnsureMapped(Entry.m_ValueOffset + Entry.m_ValueSize))
+        return {};
+
+    std::shared_ptr<unsigned char[]> Value(new unsigned char[(size_t)Entry.m_ValueSize]);
+    memcpy(Value.get(), m_File->GetMapped() + Entry.m_ValueOffset, (size_t)Entry.m_ValueSize);
+    Entry.m_LastUse = ++m_UseCounter;
+    return { std::move(Value), (size_t)Entry.m_ValueSize };
+}
+
+void FileCache::Store(std::string_view Key, const void* Value, size_t ValueSize) noexcept
+{
+    try
+    {
+        std::lock_guard lock(m_Lock);
+        if (!m_File || Key.size() > UINT32_MAX)
+            return;
+
+        uint64_t Size = EntrySize(Key.size(), ValueSize);
+        if (sizeof(FileHeader) + Size > m_MaxSize)
+            return;
+        // Compacting to half the limit leaves room for more appends before the next compaction
+        if (m_FileSize + Size > m_MaxSize && !Compact(m_MaxSize / 2 > Size ? m_MaxSize / 2 - Size : 0))
+            return;
+
+        std::vector<unsigned char> Entry((size_t)Size);
+        EntryHeader Header = { EntryMagic, (uint32_t)Key.size(), ValueSize, 0 };
+        Header.Checksum = EntryChecksum(Header, Key.data(), Value);
+        memcpy(Entry.data(), &Header, sizeof(Header));
+        memcpy(Entry.data() + sizeof(Header), Key.data(), Key.size());
+        memcpy(Entry.data() + sizeof(Header) + Key.size(), Value, ValueSize);
+
+        // A partial write leaves m_FileSize where it was, so the next append overwrites it
+        if (!m_File->WriteAt(m_FileSize, Entry.data(), Entry.size()))
+            return;
+
+        m_Index[std::string(Key)] = { m_FileSize + sizeof(Header) + Key.size(), ValueSize, ++m_UseCounter };
+        m_FileSize += Size;
+    }
+    catch (...) {} // Not being able to cache something isn't an error
+}
+
+bool FileCache::Compact(uint64_t Budget)
+{
+    if (!EnsureMapped(m_FileSize))
+        return false;
+
+    using IndexIter = decltype(m_Index)::iterator;
+    std::vector<IndexIter> ByRecency;
+    ByRecency.reserve(m_Index.size());
+    for (auto iter = m_Index.begin(); iter != m_Index.end(); ++iter)
+        ByRecency.push_back(iter);
+    std::sort(ByRecency.begin(), ByRecency.end(),
+              [](IndexIter const& a, IndexIter const& b) { return a->second.m_LastUse > b->second.m_LastUse; });
+
+    std::string TempPath = m_Path + ".tmp";
+    File Temp;
+    if (!Temp.Open(TempPath))
+        return false;
+    ScopeExit RemoveTemp([&]()
+    {
+        Temp.Close();
+        std::error_code ec;
+        std::filesystem::remove(TempPath, ec);
+    });
+    if (!Temp.Truncate(0))
+        return false;
+
+    FileHeader Header = {};
+    memcpy(Header.Magic, FileMagic, sizeof(FileMagic));
+    Header.FormatVersion = FormatVersion;
+    Header.HeaderSize = sizeof(Header);
+    Header.CacheVersion = m_Version;
+    Header.Checksum = HeaderChecksum(Header);
+    uint64_t NewSize = sizeof(Header);
+    if (!Temp.WriteAt(0, &Header, sizeof(Header)))
+        return false;
+
+    // New value offsets, only applied once the new file has replaced the old one
+    std::vector<std::pair<IndexIter, uint64_t>> Kept;
+    std::vector<unsigned char> Buffer;
+    for (auto& iter : ByRecency)
+    {
+        std::string const& Key = iter->first;
+        uint64_t ValueSize = iter->second.m_ValueSize;
+        uint64_t Size = EntrySize(Key.size(), ValueSize);
+        if (NewSize + Size > Budget)
+            break;
+
+        const unsigned char* pValue = m_File->GetMapped() + iter->second.m_ValueOffset;
+        Buffer.assign((size_t)Size, 0);
+        EntryHeader Entry = { EntryMagic, (uint32_t)Key.size(), ValueSize, 0 };
+        Entry.Checksum = EntryChecksum(Entry, Key.data(), pValue);
+        memcpy(Buffer.data(), &Entry, sizeof(Entry));
+        memcpy(Buffer.data() + sizeof(Entry), Key.data(), Key.size());
+        memcpy(Buffer.data() + sizeof(Entry) + Key.size(), pValue, (size_t)ValueSize);
+        if (!Temp.WriteAt(NewSize, Buffer.data(), Buffer.size()))
+            return false;
+
+        Kept.emplace_back(iter, NewSize + sizeof(EntryHeader) + Key.size());
+        NewSize += Size;
+    }
+    Temp.Flush();
+    Temp.Close();
+
+    // The old file has to be closed for the new one to replace it. If it can't be replaced, keep
+    // using the old one, and if neither can be reopened, there's no more caching.
+    m_File->Close();
+    std::error_code ec;
+    std::filesystem::rename(TempPath, m_Path, ec);
+    bool Replaced = !ec;
+    if (Replaced)
+        RemoveTemp.release();
+
+    if (!m_File->Open(m_Path))
+    {
+        m_File.reset();
+        m_Index.clear();
+        return false;
+    }
+    if (!Replaced)
+    {
+        (void)m_File->Map(m_FileSize);
+        return false;
+    }
+
+    decltype(m_Index) NewIndex;
+    for (auto& [iter, ValueOffset] : Kept)
+    {
+        NewIndex.emplace(iter->first, IndexEntry{ ValueOffset, iter->second.m_ValueSize, iter->second.m_LastUse });
+    }
+    m_Index = std::move(NewIndex);
+    m_FileSize = NewSize;
+    return m_File->Map(m_FileSize);
+}
@@ -3,6 +3,7 @@
 #include "kernel.hpp"
 #include "sampler.hpp"
 #include "compiler.hpp"
+#include "hash.hpp"
 
 extern CL_API_ENTRY cl_kernel CL_API_CALL
 clCreateKernel(cl_program      program_,
@@ -19,31 +20,51 @@ clCreateKernel(cl_program      program_,
     auto ReportError = program.GetContext().GetErrorReporter(errcode_ret);
     const CompiledDxil* kernel = nullptr;
 
+    try
     {
-        std::lock_guard Lock(program.m_Lock);
-        cl_uint DeviceCountWithProgram = 0, DeviceCountWithKernel = 0;
-        for (auto& [Device, _] : program.m_AssociatedDevices)
+        // Generic DXIL may be generated on demand, which mustn't block the program
+        std::vector<std::pair<std::shared_ptr<Program::PerDeviceData>, Program::KernelData*>> Found;
+        cl_uint DeviceCountWithProgram = 0;
         {
-            auto& BuildData = program.m_BuildData[Device.Get()];
-            if (!BuildData ||
-                BuildData->m_BuildStatus != CL_BUILD_SUCCESS ||
-                BuildData->m_BinaryType != CL_PROGRAM_BINARY_TYPE_EXECUTABLE)
+            std::lock_guard Lock(program.m_Lock);
+            for (auto& [Device, _] : program.m_AssociatedDevices)
             {
-                continue;
+                auto& BuildData = program.m_BuildData[Device.Get()];
+                if (!BuildData ||
+                    BuildData->m_BuildStatus != CL_BUILD_SUCCESS ||
+                    BuildData->m_BinaryType != CL_PROGRAM_BINARY_TYPE_EXECUTABLE)
+                {
+                    continue;
+                }
+
+                ++DeviceCountWithProgram;
+                auto iter = BuildData->m_Kernels.find(kernel_name);
+                if (iter != BuildData->m_Kernels.end())
+                {
+                    Found.emplace_back(BuildData, &iter->second);
+                }
             }
+        }
+        if (!DeviceCountWithProgram)
+        {
+            return ReportError("No executable available for program.", CL_INVALID_PROGRAM_EXECUTABLE);
+        }
+        if (Found.empty())
+        {
+            return ReportError("No kernel with that name found.", CL_INVALID_KERNEL_NAME);
+        }
 
-            ++DeviceCountWithProgram;
-            auto iter = BuildData->m_Kernels.find(kernel_name);
-            if (iter == BuildData->m_Kernels.end())
+        for (auto& [BuildData, KernelData] : Found)
+        {
+            auto Dxil = program.GetGenericDxil(*BuildData, kernel_name, *KernelData);
+            if (!Dxil)
             {
-                continue;
+                return ReportError("Kernel failed to compile.", CL_OUT_OF_RESOURCES);
             }
-
-            ++DeviceCountWithKernel;
             if (kernel)
             {
                 auto& first_info = kernel->GetMetadata().program_kernel_info;
-                auto& second_info = iter->second.m_GenericDxil->GetMetadata().program_kernel_info;
+                auto& second_info = Dxil->GetMetadata().program_kernel_info;
                 if (first_info.args.size() != second_info.args.size())
                 {
                     return ReportError("Kernel argument count differs between devices.", CL_INVALID_KERNEL_DEFINITION);
@@ -65,24 +86,9 @@ clCreateKernel(cl_program      program_,
                     }
                 }
             }
-            kernel = iter->second.m_GenericDxil.get();
-            if (!kernel)
-            {
-                return ReportError("Kernel failed to compile.", CL_OUT_OF_RESOURCES);
-            }
+            kernel = Dxil;
         }
-        if (!DeviceCountWithProgram)
-        {
-            return ReportError("No executable available for program.", CL_INVALID_PROGRAM_EXECUTABLE);
-        }
-        if (!DeviceCountWithKernel)
-        {
-            return ReportError("No kernel with that name found.", CL_INVALID_KERNEL_NAME);
-        }
-    }
 
-    try
-    {
         if (errcode_ret) *errcode_ret = CL_SUCCESS;
         return new Kernel(program, kernel_name, *kernel);
     }
@@ -199,6 +205,26 @@ clSetKernelArg(cl_kernel    kernel,
     return static_cast<Kernel*>(kernel)->SetArg(arg_index, arg_size, arg_value);
 }
 
+extern CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArgsMSFT(cl_kernel    kernel_,
+    cl_uint            first_arg,
+    cl_uint            num_args,
+    const size_t*      arg_sizes,
+    const void* const* arg_values)
+{
+    if (!kernel_)
+    {
+        return CL_INVALID_KERNEL;
+    }
+    Kernel& kernel = *static_cast<Kernel*>(kernel_);
+    auto ReportError = kernel.m_Parent->GetContext().GetErrorReporter();
+    if (num_args == 0 || !arg_sizes || !arg_values)
+    {
+        return ReportError("num_args must be nonzero, and arg_sizes and arg_values must be provided.", CL_INVALID_VALUE);
+    }
+    return kernel.SetArgs(first_arg, num_args, arg_sizes, arg_values);
+}
+
 static cl_mem_object_type MemObjectTypeFromName(const char* name)
 {
     if (strcmp(name, "image1d_buffer_t") == 0) return CL_MEM_OBJECT_IMAGE1D_BUFFER;
@@ -286,6 +312,7 @@ Kernel::Kernel(Program& Parent, std::string const& name, CompiledDxil const& Dxi
     m_SRVs.resize(m_ShaderDecls.m_ResourceDecls.size());
     m_Samplers.resize(m_ShaderDecls.m_NumSamplers);
     m_ArgMetadataToCompiler.resize(Dxil.GetMetadata().args.size());
+    m_ArgBindings.resize(Dxil.GetMetadata().args.size());
     for (cl_uint i = 0; i < Dxil.GetMetadata().args.size(); ++i)
     {
         auto& meta = Dxil.GetMetadata().args[i];
@@ -294,6 +321,48 @@ Kernel::Kernel(Program& Parent, std::string const& name, CompiledDxil const& Dxi
             config = CompiledDxil::Configuration::Arg::Local{ 0 };
         else if (std::holds_alternative<CompiledDxil::Metadata::Arg::Sampler>(meta.properties))
             config = CompiledDxil::Configuration::Arg::Sampler{};
+
+        auto& info = Dxil.GetMetadata().program_kernel_info.args[i];
+        auto& binding = m_ArgBindings[i];
+        binding = {};
+        binding.m_CBOffset = meta.offset;
+        binding.m_Size = meta.size;
+        switch (info.address_qualifier)
+        {
+        case ProgramBinary::Kernel::Arg::AddressSpace::Global:
+        case ProgramBinary::Kernel::Arg::AddressSpace::Constant:
+            binding.m_ImageType = MemObjectTypeFromName(info.type_name);
+            if (binding.m_ImageType != 0)
+            {
+                auto& imageMeta = std::get<CompiledDxil::Metadata::Arg::Image>(meta.properties);
+                binding.m_Kind = info.writable ? ArgBinding::Kind::WritableImage : ArgBinding::Kind::ReadOnlyImage;
+                binding.m_Readable = info.readable;
+                binding.m_NumSlots = (uint8_t)imageMeta.num_buffer_ids;
+                std::copy(imageMeta.buffer_ids, imageMeta.buffer_ids + imageMeta.num_buffer_ids, binding.m_Slots.begin());
+            }
+            else
+            {
+                binding.m_Kind = ArgBinding::Kind::Buffer;
+                binding.m_NumSlots = 1;
+                binding.m_Slots[0] = std::get<CompiledDxil::Metadata::Arg::Memory>(meta.properties).buffer_id;
+            }
+            break;
+        case ProgramBinary::Kernel::Arg::AddressSpace::Private:
+            if (strcmp(info.type_name, "sampler_t") == 0)
+            {
+                binding.m_Kind = ArgBinding::Kind::Sampler;
+                binding.m_NumSlots = 1;
+                binding.m_Slots[0] = std::get<CompiledDxil::Metadata::Arg::Sampler>(meta.properties).sampler_id;
+            }
+            else
+            {
+                binding.m_Kind = ArgBinding::Kind::Value;
+            }
+            break;
+        case ProgramBinary::Kernel::Arg::AddressSpace::Local:
+            binding.m_Kind = ArgBinding::Kind::Local;
+            break;
+        }
     }
     size_t KernelInputsCbSize = Dxil.GetMetadata().kernel_inputs_buf_size;
     m_KernelArgsCbData.resize(KernelInputsCbSize);
@@ -321,6 +390,18 @@ Kernel::Kernel(Program& Parent, std::string const& name, CompiledDxil const& Dxi
         m_UAVs[constMeta.uav_id] = resource;
     }
 
+    if (!Dxil.GetMetadata().printfs.empty())
+    {
+        m_PrintfPlans = std::make_shared<const PrintfFormatPlans>(CreatePrintfFormatPlans(Dxil.GetMetadata()));
+    }
+
+    m_SpecializationTables = Parent.GetSpecializationTables(m_Name);
+
+    if (WorkGroupTuner::IsEnabled())
+    {
+        m_TuningHash = HashBytes(Dxil.GetBinary(), Dxil.GetBinarySize());
+    }
+
     m_Parent->KernelCreated();
 }
 
@@ -333,9 +414,13 @@ Kernel::Kernel(Kernel const& other)
     , m_SRVs(other.m_SRVs)
     , m_Samplers(other.m_Samplers)
     , m_ArgMetadataToCompiler(other.m_ArgMetadataToCompiler)
+    , m_ArgBindings(other.m_ArgBindings)
     , m_KernelArgsCbData(other.m_KernelArgsCbData)
     , m_ConstSamplers(other.m_ConstSamplers)
     , m_InlineConsts(other.m_InlineConsts)
+    , m_PrintfPlans(other.m_PrintfPlans)
+    , m_SpecializationTables(other.m_SpecializationTables)
+    , m_TuningHash(other.m_TuningHash)
 {
     m_Parent->KernelCreated();
 }
@@ -345,133 +430,83 @@ Kernel::~Kernel()
     m_Parent->KernelFreed();
 }
 
-cl_int Kernel::SetArg(cl_uint arg_index, size_t arg_size, const void* arg_value)
+cl_int Kernel::ValidateArg(cl_uint arg_index, size_t arg_size, const void* arg_value) const
 {
     auto ReportError = m_Parent->GetContext().GetErrorReporter();
-    if (arg_index > m_Dxil.GetMetadata().args.size())
+    if (arg_index >= m_ArgBindings.size())
     {
         return ReportError("Argument index out of bounds", CL_INVALID_ARG_INDEX);
     }
 
-    auto& arg_meta = m_Dxil.GetMetadata().args[arg_index];
-    auto& arg_info = m_Dxil.GetMetadata().program_kernel_info.args[arg_index];
-    switch (arg_info.address_qualifier)
+    auto& binding = m_ArgBindings[arg_index];
+    switch (binding.m_Kind)
     {
-    case ProgramBinary::Kernel::Arg::AddressSpace::Global:
-    case ProgramBinary::Kernel::Arg::AddressSpace::Constant:
+    case ArgBinding::Kind::Buffer:
     {
         if (arg_size != sizeof(cl_mem))
         {
             return ReportError("Invalid argument size, must be sizeof(cl_mem) for global and constant arguments", CL_INVALID_ARG_SIZE);
         }
-
-        cl_mem_object_type imageType = MemObjectTypeFromName(arg_info.type_name);
         cl_mem mem = arg_value ? *reinterpret_cast<cl_mem const*>(arg_value) : nullptr;
         Resource* resource = static_cast<Resource*>(mem);
-        if (imageType != 0)
+        if (resource && resource->m_Desc.image_type != CL_MEM_OBJECT_BUFFER)
         {
-            auto& imageMeta = std::get<CompiledDxil::Metadata::Arg::Image>(arg_meta.properties);
-            bool validImageType = true;
-            if (resource)
-            {
-                validImageType = resource->m_Desc.image_type == imageType;
-            }
+            return ReportError("Invalid mem object type, must be buffer.", CL_INVALID_ARG_VALUE);
+        }
+        break;
+    }
 
-            if (!validImageType)
-            {
-                return ReportError("Invalid image type.", CL_INVALID_ARG_VALUE);
-            }
+    case ArgBinding::Kind::ReadOnlyImage:
+    case ArgBinding::Kind::WritableImage:
+    {
+        if (arg_size != sizeof(cl_mem))
+        {
+            return ReportError("Invalid argument size, must be sizeof(cl_mem) for global and constant arguments", CL_INVALID_ARG_SIZE);
+        }
+        cl_mem mem = arg_value ? *reinterpret_cast<cl_mem const*>(arg_value) : nullptr;
+        Resource* resource = static_cast<Resource*>(mem);
+        if (resource && resource->m_Desc.image_type != binding.m_ImageType)
+        {
+            return ReportError("Invalid image type.", CL_INVALID_ARG_VALUE);
+        }
 
-            if (arg_info.writable)
-            {
-                if (resource && (resource->m_Flags & CL_MEM_READ_ONLY))
-                {
-                    return ReportError("Invalid mem object flags, binding read-only image to writable image argument.", CL_INVALID_ARG_VALUE);
-                }
-                if (arg_info.readable &&
-                    resource && (resource->m_Flags & CL_MEM_WRITE_ONLY))
-                {
-                    return ReportError("Invalid mem object flags, binding write-only image to read-write image argument.", CL_INVALID_ARG_VALUE);
-                }
-                for (cl_uint i = 0; i < imageMeta.num_buffer_ids; ++i)
-                {
-                    m_UAVs[imageMeta.buffer_ids[i]] = resource;
-                }
-            }
-            else
+        if (binding.m_Kind == ArgBinding::Kind::WritableImage)
+        {
+            if (resource && (resource->m_Flags & CL_MEM_READ_ONLY))
             {
-                if (resource && (resource->m_Flags & CL_MEM_WRITE_ONLY))
-                {
-                    return ReportError("Invalid mem object flags, binding write-only image to read-only image argument.", CL_INVALID_ARG_VALUE);
-                }
-                for (cl_uint i = 0; i < imageMeta.num_buffer_ids; ++i)
-                {
-                    m_SRVs[imageMeta.buffer_ids[i]] = resource;
-                }
+                return ReportError("Invalid mem object flags, binding read-only image to writable image argument.", CL_INVALID_ARG_VALUE);
             }
-
-            // Store image format in the kernel args
-            cl_image_format* ImageFormatInKernelArgs = reinterpret_cast<cl_image_format*>(
-                m_KernelArgsCbData.data() + arg_meta.offset);
-            *ImageFormatInKernelArgs = {};
-            if (resource)
+            if (binding.m_Readable &&
+                resource && (resource->m_Flags & CL_MEM_WRITE_ONLY))
             {
-                *ImageFormatInKernelArgs = resource->m_Format;
-                // The SPIR-V expects the values coming from the intrinsics to be 0-indexed, and implicitly
-                // adds the necessary values to put it back into the CL constant range
-                ImageFormatInKernelArgs->image_channel_data_type -= CL_SNORM_INT8;
-                ImageFormatInKernelArgs->image_channel_order -= CL_R;
+                return ReportError("Invalid mem object flags, binding write-only image to read-write image argument.", CL_INVALID_ARG_VALUE);
             }
         }
         else
         {
-            if (resource && resource->m_Desc.image_type != CL_MEM_OBJECT_BUFFER)
+            if (resource && (resource->m_Flags & CL_MEM_WRITE_ONLY))
             {
-                return ReportError("Invalid mem object type, must be buffer.", CL_INVALID_ARG_VALUE);
-            }
-            auto& memMeta = std::get<CompiledDxil::Metadata::Arg::Memory>(arg_meta.properties);
-            uint64_t *buffer_val = reinterpret_cast<uint64_t*>(m_KernelArgsCbData.data() + arg_meta.offset);
-            m_UAVs[memMeta.buffer_id] = resource;
-            if (resource)
-            {
-                *buffer_val = (uint64_t)memMeta.buffer_id << 32ull;
-            }
-            else
-            {
-                *buffer_val = ~0ull;
+                return ReportError("Invalid mem object flags, binding write-only image to read-only image argument.", CL_INVALID_ARG_VALUE);
             }
         }
-
         break;
     }
 
-    case ProgramBinary::Kernel::Arg::AddressSpace::Private:
-        if (strcmp(arg_info.type_name, "sampler_t") == 0)
+    case ArgBinding::Kind::Sampler:
+        if (arg_size != sizeof(cl_sampler))
         {
-            if (arg_size != sizeof(cl_sampler))
-            {
-                return ReportError("Invalid argument size, must be sizeof(cl_mem) for global arguments", CL_INVALID_ARG_SIZE);
-            }
-            cl_sampler samp = arg_value ? *reinterpret_cast<cl_sampler const*>(arg_value) : nullptr;
-            Sampler* sampler = static_cast<Sampler*>(samp);
-            auto& samplerMeta = std::get<CompiledDxil::Metadata::Arg::Sampler>(arg_meta.properties);
-            auto& samplerConfig = std::get<CompiledDxil::Configuration::Arg::Sampler>(m_ArgMetadataToCompiler[arg_index].config);
-            m_Samplers[samplerMeta.sampler_id] = sampler;
-            samplerConfig.normalizedCoords = sampler ? sampler->m_Desc.NormalizedCoords : 1u;
-            samplerConfig.addressingMode = sampler ? SpirvAddressingModeFromCL(sampler->m_Desc.AddressingMode) : 0u;
-            samplerConfig.linearFiltering = sampler ? (sampler->m_Desc.FilterMode == CL_FILTER_LINEAR) : 0u;
+            return ReportError("Invalid argument size, must be sizeof(cl_mem) for global arguments", CL_INVALID_ARG_SIZE);
         }
-        else
+        break;
+
+    case ArgBinding::Kind::Value:
+        if (arg_size != binding.m_Size)
         {
-            if (arg_size != arg_meta.size)
-            {
-                return ReportError("Invalid argument size", CL_INVALID_ARG_SIZE);
-            }
-            memcpy(m_KernelArgsCbData.data() + arg_meta.offset, arg_value, arg_size);
+            return ReportError("Invalid argument size", CL_INVALID_ARG_SIZE);
         }
         break;
 
-    case ProgramBinary::Kernel::Arg::AddressSpace::Local:
+    case ArgBinding::Kind::Local:
         if (arg_size == 0)
         {
             return ReportError("Argument size must be nonzero for local arguments", CL_INVALID_ARG_SIZE);
@@ -480,14 +515,110 @@ cl_int Kernel::SetArg(cl_uint arg_index, size_t arg_size, const void* arg_value)
         {
             return ReportError("Argument value must be null for local arguments", CL_INVALID_ARG_VALUE);
         }
-        auto& localConfig = std::get<CompiledDxil::Configuration::Arg::Local>(m_ArgMetadataToCompiler[arg_index].config);
-        localConfig.size = (cl_uint)arg_size;
         break;
     }
 
     return CL_SUCCESS;
 }
 
+void Kernel::ApplyArg(cl_uint arg_index, size_t arg_size, const void* arg_value) noexcept
+{
+    auto& binding = m_ArgBindings[arg_index];
+    switch (binding.m_Kind)
+    {
+    case ArgBinding::Kind::Buffer:
+    {
+        Resource* resource = static_cast<Resource*>(arg_value ? *reinterpret_cast<cl_mem const*>(arg_value) : nullptr);
+        uint64_t buffer_val = resource ? (uint64_t)binding.m_Slots[0] << 32ull : ~0ull;
+        memcpy(m_KernelArgsCbData.data() + binding.m_CBOffset, &buffer_val, sizeof(buffer_val));
+        if (m_UAVs[binding.m_Slots[0]] != resource)
+            m_BindingsDirty = true;
+        m_UAVs[binding.m_Slots[0]] = resource;
+        break;
+    }
+
+    case ArgBinding::Kind::ReadOnlyImage:
+    case ArgBinding::Kind::WritableImage:
+    {
+        Resource* resource = static_cast<Resource*>(arg_value ? *reinterpret_cast<cl_mem const*>(arg_value) : nullptr);
+        auto& views = binding.m_Kind == ArgBinding::Kind::WritableImage ? m_UAVs : m_SRVs;
+        for (cl_uint i = 0; i < binding.m_NumSlots; ++i)
+        {
+            if (views[binding.m_Slots[i]] != resource)
+                m_BindingsDirty = true;
+            views[binding.m_Slots[i]] = resource;
+        }
+
+        // Store image format in the kernel args
+        cl_image_format ImageFormatInKernelArgs = {};
+        if (resource)
+        {
+            ImageFormatInKernelArgs = resource->m_Format;
+            // The SPIR-V expects the values coming from the intrinsics to be 0-indexed, and implicitly
+            // adds the necessary values to put it back into the CL constant range
+            ImageFormatInKernelArgs.image_channel_data_type -= CL_SNORM_INT8;
+            ImageFormatInKernelArgs.image_channel_order -= CL_R;
+        }
+        memcpy(m_KernelArgsCbData.data() + binding.m_CBOffset, &ImageFormatInKernelArgs, sizeof(ImageFormatInKernelArgs));
+        break;
+    }
+
+    case ArgBinding::Kind::Sampler:
+    {
+        Sampler* sampler = static_cast<Sampler*>(arg_value ? *reinterpret_cast<cl_sampler const*>(arg_value) : nullptr);
+        auto& samplerConfig = std::get<CompiledDxil::Configuration::Arg::Sampler>(m_ArgMetadataToCompiler[arg_index].config);
+        if (m_Samplers[binding.m_Slots[0]] != sampler)
+            m_BindingsDirty = true;
+        m_Samplers[binding.m_Slots[0]] = sampler;
+        samplerConfig.normalizedCoords = sampler ? sampler->m_Desc.NormalizedCoords : 1u;
+        samplerConfig.addressingMode = sampler ? SpirvAddressingModeFromCL(sampler->m_Desc.AddressingMode) : 0u;
+        samplerConfig.linearFiltering = sampler ? (sampler->m_Desc.FilterMode == CL_FILTER_LINEAR) : 0u;
+        break;
+    }
+
+    case ArgBinding::Kind::Value:
+        memcpy(m_KernelArgsCbData.data() + binding.m_CBOffset, arg_value, arg_size);
+        break;
+
+    case ArgBinding::Kind::Local:
+        std::get<CompiledDxil::Configuration::Arg::Local>(m_ArgMetadataToCompiler[arg_index].config).size = (cl_uint)arg_size;
+        break;
+    }
+}
+
+cl_int Kernel::SetArg(cl_uint arg_index, size_t arg_size, const void* arg_value)
+{
+    cl_int ret = ValidateArg(arg_index, arg_size, arg_value);
+    if (ret == CL_SUCCESS)
+    {
+        ApplyArg(arg_index, arg_size, arg_value);
+    }
+    return ret;
+}
+
+cl_int Kernel::SetArgs(cl_uint first_arg, cl_uint num_args, const size_t* arg_sizes, const void* const* arg_values)
+{
+    if (first_arg >= m_ArgBindings.size() || num_args > m_ArgBindings.size() - first_arg)
+    {
+        return m_Parent->GetContext().GetErrorReporter()("Argument index out of bounds", CL_INVALID_ARG_INDEX);
+    }
+
+    // All arguments are validated before any are applied, so a failure leaves the kernel unchanged
+    for (cl_uint i = 0; i < num_args; ++i)
+    {
+        cl_int ret = ValidateArg(first_arg + i, arg_sizes[i], arg_values[i]);
+        if (ret != CL_SUCCESS)
+        {
+            return ret;
+        }
+    }
+    for (cl_uint i = 0; i < num_args; ++i)
+    {
+        ApplyArg(first_arg + i, arg_sizes[i], arg_values[i]);
+    }
+    return CL_SUCCESS;
+}
+
 uint16_t const* Kernel::GetRequiredLocalDims() const
 {
     if (m_Dxil.GetMetadata().local_size[0] != 0)
@@ -502,6 +633,20 @@ uint16_t const* Kernel::GetLocalDimsHint() const
     return nullptr;
 }
 
+size_t Kernel::GetLocalMemSize() const
+{
+    size_t size = m_Dxil.GetMetadata().local_mem_size;
+    for (cl_uint i = 0; i < m_Dxil.GetMetadata().args.size(); ++i)
+    {
+        if (m_Dxil.GetMetadata().program_kernel_info.args[i].address_qualifier == ProgramBinary::Kernel::Arg::AddressSpace::Local)
+        {
+            size -= 4;
+            size += std::get<CompiledDxil::Configuration::Arg::Local>(m_ArgMetadataToCompiler[i].config).size;
+        }
+    }
+    return size;
+}
+
 extern CL_API_ENTRY cl_int CL_API_CALL
 clGetKernelInfo(cl_kernel       kernel_,
     cl_kernel_info  param_name,
@@ -627,19 +772,7 @@ clGetKernelWorkGroupInfo(cl_kernel                  kernel_,
             std::copy(ReqDims, ReqDims + 3, size);
         return RetValue(size);
     }
-    case CL_KERNEL_LOCAL_MEM_SIZE:
-    {
-        size_t size = kernel.m_Dxil.GetMetadata().local_mem_size;
-        for (cl_uint i = 0; i < kernel.m_Dxil.GetMetadata().args.size(); ++i)
-        {
-            if (kernel.m_Dxil.GetMetadata().program_kernel_info.args[i].address_qualifier == ProgramBinary::Kernel::Arg::AddressSpace::Local)
-            {
-                size -= 4;
-                size += std::get<CompiledDxil::Configuration::Arg::Local>(kernel.m_ArgMetadataToCompiler[i].config).size;
-            }
-        }
-        return RetValue(size);
-    }
+    case CL_KERNEL_LOCAL_MEM_SIZE: return RetValue(kernel.GetLocalMemSize());
     case CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE: return RetValue((size_t)64);
     case CL_KERNEL_PRIVATE_MEM_SIZE: return RetValue(kernel.m_Dxil.GetMetadata().priv_mem_size);
     }
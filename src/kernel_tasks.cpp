@@ -9,12 +9,9 @@
 #include "compiler.hpp"
 
 #include <wil/resource.h>
-#include <sstream>
 #include <numeric>
 
 extern void SignBlob(void* pBlob, size_t size);
-constexpr uint32_t PrintfBufferSize = 1024 * 1024;
-constexpr uint32_t PrintfBufferInitialData[PrintfBufferSize / sizeof(uint32_t)] = { sizeof(uint32_t) * 2, PrintfBufferSize };
 
 auto Program::SpecializationKey::Allocate(D3DDevice const* Device, CompiledDxil::Configuration const& conf) -> std::unique_ptr<SpecializationKey>
 {
@@ -28,38 +25,48 @@ auto Program::SpecializationKey::Allocate(D3DDevice const* Device, CompiledDxil:
 Program::SpecializationKey::SpecializationKey(D3DDevice const* Device, CompiledDxil::Configuration const& conf)
 {
     this->Device = Device;
-    ConfigData.Bits.LocalSize[0] = conf.local_size[0];
-    ConfigData.Bits.LocalSize[1] = conf.local_size[1];
-    ConfigData.Bits.LocalSize[2] = conf.local_size[2];
-    ConfigData.Bits.SupportGlobalOffsets = conf.support_global_work_id_offsets;
-    ConfigData.Bits.SupportLocalOffsets = conf.support_work_group_id_offsets;
-    ConfigData.Bits.LowerInt64 = conf.lower_int64;
-    ConfigData.Bits.LowerInt16 = conf.lower_int64;
-    ConfigData.Bits.Padding = 0;
+    ConfigData.Value = PackConfig(conf);
 
     NumArgs = (uint32_t)conf.args.size();
     for (uint32_t i = 0; i < NumArgs; ++i)
     {
-        memset(&Args[i], 0, sizeof(Args[i]));
-        if (auto localConfig = std::get_if<CompiledDxil::Configuration::Arg::Local>(&conf.args[i].config); localConfig)
-        {
-            Args[i].LocalArgSize = localConfig->size;
-        }
-        else if (auto samplerConfig = std::get_if<CompiledDxil::Configuration::Arg::Sampler>(&conf.args[i].config); samplerConfig)
-        {
-            Args[i].SamplerArgData.AddressingMode = samplerConfig->addressingMode;
-            Args[i].SamplerArgData.LinearFiltering = samplerConfig->linearFiltering;
-            Args[i].SamplerArgData.NormalizedCoords = samplerConfig->normalizedCoords;
-            Args[i].SamplerArgData.Padding = 0;
-        }
-        else
-        {
-            Args[i].LocalArgSize = 0;
-        }
+        Args[i] = PackArg(conf.args[i]);
+    }
+}
+
+uint64_t Program::SpecializationKey::PackConfig(CompiledDxil::Configuration const& conf)
+{
+    decltype(ConfigData) Packed;
+    Packed.Bits.LocalSize[0] = conf.local_size[0];
+    Packed.Bits.LocalSize[1] = conf.local_size[1];
+    Packed.Bits.LocalSize[2] = conf.local_size[2];
+    Packed.Bits.SupportGlobalOffsets = conf.support_global_work_id_offsets;
+    Packed.Bits.SupportLocalOffsets = conf.support_work_group_id_offsets;
+    Packed.Bits.LowerInt64 = conf.lower_int64;
+    Packed.Bits.LowerInt16 = conf.lower_int64;
+    Packed.Bits.Padding = 0;
+    return Packed.Value;
+}
+
+auto Program::SpecializationKey::PackArg(CompiledDxil::Configuration::Arg const& arg) -> PackedArgData
+{
+    PackedArgData Packed;
+    memset(&Packed, 0, sizeof(Packed));
+    if (auto localConfig = std::get_if<CompiledDxil::Configuration::Arg::Local>(&arg.config); localConfig)
+    {
+        Packed.LocalArgSize = localConfig->size;
+    }
+    else if (auto samplerConfig = std::get_if<CompiledDxil::Configuration::Arg::Sampler>(&arg.config); samplerConfig)
+    {
+        Packed.SamplerArgData.AddressingMode = samplerConfig->addressingMode;
+        Packed.SamplerArgData.LinearFiltering = samplerConfig->linearFiltering;
+        Packed.SamplerArgData.NormalizedCoords = samplerConfig->normalizedCoords;
+        Packed.SamplerArgData.Padding = 0;
     }
+    return Packed;
 }
 
-size_t Program::SpecializationKeyHash::operator()(std::unique_ptr<Program::SpecializationKey> const& ptr) const
+size_t Program::SpecializationKeyHash::operator()(Program::SpecializationKey const* ptr) const
 {
     size_t val = std::hash<uint64_t>()(ptr->ConfigData.Value);
     D3D12TranslationLayer::hash_combine(val, std::hash<const void *>()(ptr->Device));
@@ -70,17 +77,141 @@ size_t Program::SpecializationKeyHash::operator()(std::unique_ptr<Program::Speci
     return val;
 }
 
-bool Program::SpecializationKeyEqual::operator()(std::unique_ptr<Program::SpecializationKey> const& a,
-                                                 std::unique_ptr<Program::SpecializationKey> const& b) const
+bool Program::SpecializationKeyEqual::operator()(Program::SpecializationKey const* a,
+                                                 Program::SpecializationKey const* b) const
 {
     assert(a->NumArgs == b->NumArgs);
     uint32_t NumAllocatedArgs = a->NumArgs ? a->NumArgs - 1 : 0;
     size_t size = sizeof(Program::SpecializationKey) +
         sizeof(Program::SpecializationKey::PackedArgData) * NumAllocatedArgs;
-    return memcmp(a.get(), b.get(), size) == 0;
+    return memcmp(a, b, size) == 0;
+}
+
+Program::SpecializationTable::SpecializationTable()
+{
+    auto Initial = std::make_unique<Slots>();
+    Initial->m_Slots.reset(new Slot[16]);
+    Initial->m_Mask = 15;
+    m_Current.store(Initial.get(), std::memory_order_relaxed);
+    m_AllSlots.push_back(std::move(Initial));
+}
+
+Program::SpecializationTable::~SpecializationTable() = default;
+
+// Same as SpecializationKeyHash, minus the device, which is implied by the table
+size_t Program::SpecializationTable::Hash(SpecializationKey const* key)
+{
+    size_t val = std::hash<uint64_t>()(key->ConfigData.Value);
+    for (uint32_t i = 0; i < key->NumArgs; ++i)
+    {
+        D3D12TranslationLayer::hash_combine(val, key->Args[i].LocalArgSize);
+    }
+    return val;
+}
+
+Program::SpecializationValue* Program::SpecializationTable::Find(uint64_t configData, CompiledDxil::Configuration::Arg const* args, uint32_t numArgs) const noexcept
+{
+    SpecializationKey::PackedArgData PackedArgs[16];
+    if (numArgs > std::size(PackedArgs))
+    {
+        // Rare enough to not be worth handling without allocating, let the slow path deal with it
+        return nullptr;
+    }
+
+    size_t hash = std::hash<uint64_t>()(configData);
+    for (uint32_t i = 0; i < numArgs; ++i)
+    {
+        PackedArgs[i] = SpecializationKey::PackArg(args[i]);
+        D3D12TranslationLayer::hash_combine(hash, PackedArgs[i].LocalArgSize);
+    }
+
+    Slots const* Current = m_Current.load(std::memory_order_acquire);
+    for (uint32_t i = (uint32_t)hash & Current->m_Mask;; i = (i + 1) & Current->m_Mask)
+    {
+        Slot const& slot = Current->m_Slots[i];
+        SpecializationKey const* key = slot.m_Key.load(std::memory_order_acquire);
+        if (!key)
+            return nullptr;
+        if (slot.m_Hash == hash &&
+            key->ConfigData.Value == configData &&
+            key->NumArgs == numArgs &&
+            memcmp(key->Args, PackedArgs, sizeof(PackedArgs[0]) * numArgs) == 0)
+        {
+            return slot.m_Value;
+        }
+    }
+}
+
+void Program::SpecializationTable::Insert(SpecializationKey const* key, SpecializationValue* value)
+{
+    auto InsertInto = [](Slots const& slots, SpecializationKey const* key, SpecializationValue* value, size_t hash)
+    {
+        uint32_t i = (uint32_t)hash & slots.m_Mask;
+        while (slots.m_Slots[i].m_Key.load(std::memory_order_relaxed))
+            i = (i + 1) & slots.m_Mask;
+        slots.m_Slots[i].m_Value = value;
+        slots.m_Slots[i].m_Hash = hash;
+        // Publishing the key makes the rest of the slot visible to readers
+        slots.m_Slots[i].m_Key.store(key, std::memory_order_release);
+    };
+
+    Slots const* Current = m_Current.load(std::memory_order_relaxed);
+    if ((m_Count + 1) * 2 > Current->m_Mask + 1)
+    {
+        // Keep the load factor under 1/2 so probes stay short and always find an empty slot
+        auto Grown = std::make_unique<Slots>();
+        Grown->m_Mask = Current->m_Mask * 2 + 1;
+        Grown->m_Slots.reset(new Slot[Grown->m_Mask + 1]);
+        for (uint32_t i = 0; i <= Current->m_Mask; ++i)
+        {
+            Slot const& slot = Current->m_Slots[i];
+            if (auto existing = slot.m_Key.load(std::memory_order_relaxed))
+                InsertInto(*Grown, existing, slot.m_Value, slot.m_Hash);
+        }
+        m_AllSlots.push_back(std::move(Grown));
+        Current = m_AllSlots.back().get();
+        InsertInto(*Current, key, value, Hash(key));
+        m_Current.store(Current, std::memory_order_release);
+    }
+    else
+    {
+        InsertInto(*Current, key, value, Hash(key));
+    }
+    ++m_Count;
+}
+
+auto Program::GetSpecializationTables(std::string const& kernelName) const -> std::vector<std::pair<Device*, SpecializationTable*>>
+{
+    std::vector<std::pair<Device*, SpecializationTable*>> ret;
+    std::lock_guard programLock(m_Lock);
+    for (auto& [device, buildData] : m_BuildData)
+    {
+        if (!buildData)
+            continue;
+        if (auto iter = buildData->m_Kernels.find(kernelName); iter != buildData->m_Kernels.end())
+            ret.emplace_back(device, &iter->second.m_SpecializationTable);
+    }
+    return ret;
+}
+
+Program::SpecializationValue* Program::PendingSpecialization::Wait()
+{
+    std::unique_lock lock(m_Lock);
+    m_Event.wait(lock, [this]() { return m_Done; });
+    return m_Value;
+}
+
+void Program::PendingSpecialization::Complete(SpecializationValue* value)
+{
+    {
+        std::lock_guard lock(m_Lock);
+        m_Value = value;
+        m_Done = true;
+    }
+    m_Event.notify_all();
 }
 
-Program::SpecializationValue* Program::FindExistingSpecialization(Device* device, std::string const& kernelName, std::unique_ptr<Program::SpecializationKey> const& key) const
+auto Program::FindOrBeginSpecialization(Device* device, std::string const& kernelName, std::unique_ptr<Program::SpecializationKey> const& key) -> SpecializationLookup
 {
     std::lock_guard programLock(m_Lock);
     auto buildDataIter = m_BuildData.find(device);
@@ -90,47 +221,186 @@ Program::SpecializationValue* Program::FindExistingSpecialization(Device* device
     assert(kernelsIter != buildData->m_Kernels.end());
     auto& kernel = kernelsIter->second;
 
+    SpecializationLookup ret;
     std::lock_guard specializationCacheLock(buildData->m_SpecializationCacheLock);
-    auto iter = kernel.m_SpecializationCache.find(key);
-    if (iter != kernel.m_SpecializationCache.end())
-        return &iter->second;
+    if (auto iter = kernel.m_SpecializationCache.find(key); iter != kernel.m_SpecializationCache.end())
+    {
+        ret.Existing = &iter->second;
+        return ret;
+    }
+
+    // If someone else is already compiling this, just wait for them to finish
+    auto [pendingIter, inserted] = kernel.m_PendingSpecializations.try_emplace(key.get());
+    if (inserted)
+    {
+        pendingIter->second = std::make_shared<PendingSpecialization>();
+    }
+    ret.Pending = pendingIter->second;
+    ret.ShouldCompile = inserted;
+    return ret;
+}
+
+void Program::AbandonSpecialization(Device* device, std::string const& kernelName, std::unique_ptr<Program::SpecializationKey> const& key)
+{
+    std::shared_ptr<PendingSpecialization> pending;
+    {
+        std::lock_guard programLock(m_Lock);
+        auto& buildData = m_BuildData[device];
+        std::lock_guard specializationCacheLock(buildData->m_SpecializationCacheLock);
+        auto& kernel = buildData->m_Kernels.find(kernelName)->second;
+        if (auto iter = kernel.m_PendingSpecializations.find(key.get()); iter != kernel.m_PendingSpecializations.end())
+        {
+            pending = std::move(iter->second);
+            kernel.m_PendingSpecializations.erase(iter);
+        }
+    }
+    if (pending)
+        pending->Complete(nullptr);
+}
+
+namespace
+{
+    // Everything that identifies a specialization across processes, including the linked SPIR-V it
+    // was generated from. The device is implied by which device's cache is used, and the compiler
+    // version by the cache's version.
+    struct PersistedSpecializationKey
+    {
+        ShaderCache &Cache;
+        std::array<const void*, 5> Parts;
+        std::array<size_t, 5> Sizes;
+        struct
+        {
+            GUID Tag;
+            uint64_t ConfigData;
+        } Header;
 
-    return nullptr;
+        PersistedSpecializationKey(D3DDevice const& Device, ProgramBinary const& Binary,
+                                   const char* KernelName, Program::SpecializationKey const& key)
+            : Cache(Device.GetShaderCache())
+        {
+            // {4D4F1C3B-7F3E-4B7A-9C38-6E0B2A6D5C11}
+            static const GUID SpecializationTag =
+            { 0x4d4f1c3b, 0x7f3e, 0x4b7a, { 0x9c, 0x38, 0x6e, 0xb, 0x2a, 0x6d, 0x5c, 0x11 } };
+            Header = { SpecializationTag, key.ConfigData.Value };
+            Parts = { &Header, Binary.GetBinary(), KernelName, key.Args, &key.NumArgs };
+            Sizes = { sizeof(Header), Binary.GetBinarySize(), strlen(KernelName) + 1,
+                      sizeof(key.Args[0]) * key.NumArgs, sizeof(key.NumArgs) };
+        }
+    };
 }
 
+unique_dxil Program::FindCachedSpecialization(Device* device, CompiledDxil const& generic, SpecializationKey const& key) const
+{
+    if (!key.Device->GetShaderCache().HasCache())
+        return nullptr;
+
+    std::shared_ptr<PerDeviceData> buildData;
+    {
+        std::lock_guard programLock(m_Lock);
+        buildData = m_BuildData.find(device)->second;
+    }
+
+    PersistedSpecializationKey persistedKey(*key.Device, *buildData->m_OwnedBinary,
+                                            generic.GetMetadata().program_kernel_info.name, key);
+    auto found = persistedKey.Cache.Find(persistedKey.Parts.data(), persistedKey.Sizes.data(), (unsigned)persistedKey.Parts.size());
+    if (!found.first)
+        return nullptr;
+
+    return CompiledDxil::DeserializeSpecialization(generic, found.first.get(), found.second);
+}
+
+void Program::CacheSpecialization(Device* device, CompiledDxil const& specialized, SpecializationKey const& key) const
+{
+    if (!key.Device->GetShaderCache().HasCache())
+        return;
+
+    std::shared_ptr<PerDeviceData> buildData;
+    {
+        std::lock_guard programLock(m_Lock);
+        buildData = m_BuildData.find(device)->second;
+    }
+
+    PersistedSpecializationKey persistedKey(*key.Device, *buildData->m_OwnedBinary,
+                                            specialized.GetMetadata().program_kernel_info.name, key);
+    auto serialized = specialized.SerializeSpecialization();
+    persistedKey.Cache.Store(persistedKey.Parts.data(), persistedKey.Sizes.data(), (unsigned)persistedKey.Parts.size(),
+                             serialized.data(), serialized.size());
+}
+
+// Strong references to a kernel's memory object and sampler arguments, which executions hold
+// until they complete. Views for a device are resolved and interned once, by the first execution
+// recorded on it, and reused by every later execution that shares the set.
+struct KernelArgBindingSet
+{
+    std::vector<Resource::ref_ptr_int> m_UAVs;
+    std::vector<Resource::ref_ptr_int> m_SRVs;
+    std::vector<Sampler::ref_ptr_int> m_Samplers;
+
+    KernelArgBindingSet(Kernel const& kernel)
+        : m_UAVs(kernel.m_UAVs.begin(), kernel.m_UAVs.end())
+        , m_SRVs(kernel.m_SRVs.begin(), kernel.m_SRVs.end())
+        , m_Samplers(kernel.m_Samplers.begin(), kernel.m_Samplers.end())
+    {
+    }
+
+    ComputeViewTables Resolve(D3DDevice& Device)
+    {
+        std::lock_guard Lock(m_ResolveLock);
+        if (m_ResolvedDevice != &Device)
+        {
+            std::vector<D3D12TranslationLayer::UAV*> UAVs(m_UAVs.size());
+            std::vector<D3D12TranslationLayer::SRV*> SRVs(m_SRVs.size());
+            std::vector<D3D12TranslationLayer::Sampler*> Samplers(m_Samplers.size());
+            std::transform(m_UAVs.begin(), m_UAVs.end(), UAVs.begin(), [&Device](Resource::ref_ptr_int& resource) { return resource.Get() ? &resource->GetUAV(&Device) : nullptr; });
+            std::transform(m_SRVs.begin(), m_SRVs.end(), SRVs.begin(), [&Device](Resource::ref_ptr_int& resource) { return resource.Get() ? &resource->GetSRV(&Device) : nullptr; });
+            std::transform(m_Samplers.begin(), m_Samplers.end(), Samplers.begin(), [&Device](Sampler::ref_ptr_int& sampler) { return sampler.Get() ? &sampler->GetUnderlying(&Device) : nullptr; });
+
+            auto& ViewState = Device.GetComputeViewState();
+            m_Resolved.m_UAVs = ViewState.m_UAVTables.Intern(UAVs.data(), UAVs.size());
+            m_Resolved.m_SRVs = ViewState.m_SRVTables.Intern(SRVs.data(), SRVs.size());
+            m_Resolved.m_Samplers = ViewState.m_SamplerTables.Intern(Samplers.data(), Samplers.size());
+            m_ResolvedDevice = &Device;
+        }
+        return m_Resolved;
+    }
+
+private:
+    std::mutex m_ResolveLock;
+    D3DDevice* m_ResolvedDevice = nullptr;
+    ComputeViewTables m_Resolved;
+};
+
 class ExecuteKernel : public Task
 {
 public:
     Kernel::ref_ptr_int m_Kernel;
     const std::array<uint32_t, 3> m_DispatchDims;
 
-    std::vector<D3D12TranslationLayer::UAV*> m_UAVs;
-    std::vector<D3D12TranslationLayer::SRV*> m_SRVs;
-    std::vector<D3D12TranslationLayer::Sampler*> m_Samplers;
     std::vector<D3D12TranslationLayer::Resource*> m_CBs;
     std::vector<cl_uint> m_CBOffsets;
     Resource::UnderlyingResourcePtr m_KernelArgsCb;
     std::vector<std::byte> m_KernelArgsCbData;
-    Resource::ref_ptr m_PrintfUAV;
+    std::unique_ptr<D3DDevice::PrintfBuffer> m_PrintfBuffer;
+
+    // Set when the work group tuner wants this dispatch timed
+    const WorkGroupTuner::Sample m_TuningSample;
+    std::unique_ptr<D3D12TranslationLayer::Query> m_TuningStart;
+    std::unique_ptr<D3D12TranslationLayer::Query> m_TuningStop;
 
-    std::vector<Resource::ref_ptr_int> m_KernelArgUAVs;
-    std::vector<Resource::ref_ptr_int> m_KernelArgSRVs;
-    std::vector<Sampler::ref_ptr_int> m_KernelArgSamplers;
+    std::shared_ptr<KernelArgBindingSet> m_Bindings;
 
-    std::mutex m_SpecializeLock;
-    std::condition_variable m_SpecializeEvent;
-    
+    // Either the specialization was already compiled, or this waits for it to be
     Program::SpecializationValue *m_Specialized = nullptr;
-    bool m_SpecializeError = false;
+    std::shared_ptr<Program::PendingSpecialization> m_PendingSpecialization;
 
     void MigrateResources() final
     {
-        for (auto& res : m_KernelArgUAVs)
+        for (auto& res : m_Bindings->m_UAVs)
         {
             if (res.Get())
                 res->EnqueueMigrateResource(&m_CommandQueue->GetD3DDevice(), this, 0);
         }
-        for (auto& res : m_KernelArgSRVs)
+        for (auto& res : m_Bindings->m_SRVs)
         {
             if (res.Get())
                 res->EnqueueMigrateResource(&m_CommandQueue->GetD3DDevice(), this, 0);
@@ -138,17 +408,56 @@ public:
     }
     void RecordImpl() final;
     void OnComplete() final;
+    bool GetResourceUsage(std::vector<ResourceUsage>& Usage) final
+    {
+        auto& Device = m_CommandQueue->GetD3DDevice();
+        for (auto& res : m_Bindings->m_UAVs)
+        {
+            if (res.Get())
+                Usage.push_back({ res->GetUnderlyingResource(&Device), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, (res->m_Flags & CL_MEM_READ_ONLY) == 0 });
+        }
+        for (auto& res : m_Bindings->m_SRVs)
+        {
+            if (res.Get())
+                Usage.push_back({ res->GetUnderlyingResource(&Device), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, false });
+        }
+        return true;
+    }
+
+    ~ExecuteKernel()
+    {
+        if (m_PrintfBuffer)
+        {
+            m_CommandQueue->GetD3DDevice().ReturnPrintfBuffer(std::move(m_PrintfBuffer));
+        }
+    }
+
+    static std::shared_ptr<KernelArgBindingSet> AcquireBindings(Kernel& kernel)
+    {
+        std::lock_guard lock(kernel.m_BindingSetLock);
+        std::shared_ptr<KernelArgBindingSet> Bindings;
+        if (!kernel.m_BindingsDirty)
+        {
+            // Only still alive if a previous execution hasn't completed yet, which is the case
+            // for apps that enqueue the same kernel in a loop
+            Bindings = kernel.m_LastBindingSet.lock();
+        }
+        if (!Bindings)
+        {
+            Bindings = std::make_shared<KernelArgBindingSet>(kernel);
+            kernel.m_LastBindingSet = Bindings;
+            kernel.m_BindingsDirty = false;
+        }
+        return Bindings;
+    }
 
-    ExecuteKernel(Kernel& kernel, cl_command_queue queue, std::array<uint32_t, 3> const& dims, std::array<uint32_t, 3> const& offset, std::array<uint16_t, 3> const& localSize, cl_uint workDims)
+    ExecuteKernel(Kernel& kernel, cl_command_queue queue, std::array<uint32_t, 3> const& dims, std::array<uint32_t, 3> const& offset, std::array<uint16_t, 3> const& localSize, cl_uint workDims,
+                  WorkGroupTuner::Sample const& tuningSample)
         : Task(kernel.m_Parent->GetContext(), CL_COMMAND_NDRANGE_KERNEL, queue)
         , m_Kernel(&kernel)
         , m_DispatchDims(dims)
-        , m_UAVs(kernel.m_UAVs.size(), nullptr)
-        , m_SRVs(kernel.m_SRVs.size(), nullptr)
-        , m_Samplers(kernel.m_Samplers.size(), nullptr)
-        , m_KernelArgUAVs(kernel.m_UAVs.begin(), kernel.m_UAVs.end())
-        , m_KernelArgSRVs(kernel.m_SRVs.begin(), kernel.m_SRVs.end())
-        , m_KernelArgSamplers(kernel.m_Samplers.begin(), kernel.m_Samplers.end())
+        , m_TuningSample(tuningSample)
+        , m_Bindings(AcquireBindings(kernel))
     {
         cl_uint KernelArgCBIndex = kernel.m_Dxil.GetMetadata().kernel_inputs_cbv_id;
         cl_uint WorkPropertiesCBIndex = kernel.m_Dxil.GetMetadata().work_properties_cbv_id;
@@ -233,9 +542,7 @@ public:
 
         if (kernel.m_Dxil.GetMetadata().printf_uav_id >= 0)
         {
-            m_PrintfUAV.Attach(static_cast<Resource*>(clCreateBuffer(&m_Parent.get(), CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR, PrintfBufferSize, (void*)PrintfBufferInitialData, nullptr)));
-            m_PrintfUAV->EnqueueMigrateResource(&m_CommandQueue->GetD3DDevice(), this, 0);
-            m_UAVs[kernel.m_Dxil.GetMetadata().printf_uav_id] = &m_PrintfUAV->GetUAV(&Device);
+            m_PrintfBuffer = Device.AcquirePrintfBuffer(m_Parent->GetPrintfBufferSize());
         }
 
         CompiledDxil::Configuration config = {};
@@ -244,12 +551,28 @@ public:
         config.support_global_work_id_offsets = std::any_of(std::begin(offset), std::end(offset), [](cl_uint v) { return v != 0; });
         config.support_work_group_id_offsets = numIterations != 1;
         std::copy(std::begin(localSize), std::end(localSize), config.local_size);
+
+        for (auto& [TableDevice, Table] : kernel.m_SpecializationTables)
+        {
+            if (TableDevice == m_Device.Get())
+            {
+                m_Specialized = Table->Find(Program::SpecializationKey::PackConfig(config),
+                                            kernel.m_ArgMetadataToCompiler.data(),
+                                            (uint32_t)kernel.m_ArgMetadataToCompiler.size());
+                break;
+            }
+        }
+        if (m_Specialized)
+            return;
+
         config.args = kernel.m_ArgMetadataToCompiler;
         auto SpecKey = Program::SpecializationKey::Allocate(m_D3DDevice, config);
-        
-        m_Specialized = kernel.m_Parent->FindExistingSpecialization(m_Device.Get(), kernel.m_Name, SpecKey);
 
-        if (!m_Specialized)
+        auto Lookup = kernel.m_Parent->FindOrBeginSpecialization(m_Device.Get(), kernel.m_Name, SpecKey);
+        m_Specialized = Lookup.Existing;
+        m_PendingSpecialization = std::move(Lookup.Pending);
+
+        if (Lookup.ShouldCompile)
         {
             g_Platform->QueueProgramOp([this, &Device,
                                               config = std::move(config),
@@ -261,36 +584,35 @@ public:
                 {
                     auto pCompiler = g_Platform->GetCompiler();
 
-                    auto spirv = kernel->m_Parent->GetSpirV(&m_CommandQueue->GetDevice());
-                    auto name = kernel->m_Dxil.GetMetadata().program_kernel_info.name;
-                    auto specialized = pCompiler->GetKernel(name, *spirv, &config, nullptr);
-                    if (specialized)
-                        specialized->Sign();
+                    // A previous run may have already produced this specialization
+                    auto specialized = kernel->m_Parent->FindCachedSpecialization(m_Device.Get(), kernel->m_Dxil, *SpecKey);
+                    if (!specialized)
+                    {
+                        auto spirv = kernel->m_Parent->GetSpirV(&m_CommandQueue->GetDevice());
+                        auto name = kernel->m_Dxil.GetMetadata().program_kernel_info.name;
+                        specialized = pCompiler->GetKernel(name, *spirv, &config, nullptr);
+                        if (specialized)
+                        {
+                            specialized->Sign();
+                            kernel->m_Parent->CacheSpecialization(m_Device.Get(), *specialized, *SpecKey);
+                        }
+                    }
 
                     auto CS = std::make_unique<D3D12TranslationLayer::Shader>(&Device.ImmCtx(), specialized->GetBinary(), specialized->GetBinarySize(), kernel->m_ShaderDecls);
                     D3D12TranslationLayer::COMPUTE_PIPELINE_STATE_DESC Desc = { CS.get() };
                     auto PSO = Device.CreatePSO(Desc);
 
-                    auto cacheEntry = kernel->m_Parent->StoreSpecialization(m_Device.Get(),
-                                                                            kernel->m_Name,
-                                                                            SpecKey,
-                                                                            std::move(specialized),
-                                                                            std::move(CS),
-                                                                            std::move(PSO));
-
-                    {
-                        std::lock_guard lock(m_SpecializeLock);
-                        m_Specialized = cacheEntry;
-                    }
-                    m_SpecializeEvent.notify_all();
+                    // Wakes up this task and any others that were waiting on the same specialization
+                    kernel->m_Parent->StoreSpecialization(m_Device.Get(),
+                                                          kernel->m_Name,
+                                                          SpecKey,
+                                                          std::move(specialized),
+                                                          std::move(CS),
+                                                          std::move(PSO));
                 }
                 catch (...)
                 {
-                    {
-                        std::lock_guard lock(m_SpecializeLock);
-                        m_SpecializeError = true;
-                    }
-                    m_SpecializeEvent.notify_all();
+                    kernel->m_Parent->AbandonSpecialization(m_Device.Get(), kernel->m_Name, SpecKey);
                 }
             });
         }
@@ -358,12 +680,8 @@ clEnqueueNDRangeKernel(cl_command_queue command_queue,
     std::array<uint16_t, 3> LocalSizes = { 1, 1, 1 };
     auto RequiredDims = kernel.GetRequiredLocalDims();
     auto DimsHint = kernel.GetLocalDimsHint();
-    const std::array<uint16_t, 3> AutoDims[3] =
-    {
-        { 64, 1, 1 },
-        { 8, 8, 1 },
-        { 4, 4, 4 }
-    };
+    const std::array<uint16_t, 3> AutoDims = local_work_size || DimsHint ? std::array<uint16_t, 3>{} :
+        WorkGroupSizing::HeuristicLocalSize(work_dim, queue.GetDevice().GetWaveWidth(), kernel.GetLocalMemSize());
     const std::array<uint16_t, 3> MaxDims =
     {
         D3D12_CS_THREAD_GROUP_MAX_X,
@@ -379,7 +697,7 @@ clEnqueueNDRangeKernel(cl_command_queue command_queue,
         }
 
         LocalSize = local_work_size ? (uint16_t)local_work_size[i] :
-            (DimsHint ? DimsHint[i] : AutoDims[work_dim - 1][i]);
+            (DimsHint ? DimsHint[i] : AutoDims[i]);
         if (RequiredDims)
         {
             if (RequiredDims[i] != LocalSize)
@@ -397,12 +715,7 @@ clEnqueueNDRangeKernel(cl_command_queue command_queue,
         }
         else
         {
-            while (global_work_size[i] % LocalSize != 0 ||
-                   LocalSize > MaxDims[i])
-            {
-                // TODO: Better backoff algorithm
-                LocalSize /= 2;
-            }
+            LocalSize = WorkGroupSizing::LargestDivisorAtMost(global_work_size[i], std::min(LocalSize, MaxDims[i]));
         }
     }
     if (RequiredDims)
@@ -414,17 +727,13 @@ clEnqueueNDRangeKernel(cl_command_queue command_queue,
     }
     else
     {
-        cl_uint dimension = work_dim - 1;
-        while ((uint64_t)LocalSizes[0] * (uint64_t)LocalSizes[1] * (uint64_t)LocalSizes[2] > D3D12_CS_THREAD_GROUP_MAX_THREADS_PER_GROUP)
-        {
-            // Find a dimension to shorten
-            // TODO: Better backoff algorithm
-            if (LocalSizes[dimension] > 1)
-            {
-                LocalSizes[dimension] /= 2;
-            }
-            dimension = (dimension == 0) ? work_dim - 1 : dimension - 1;
-        }
+        WorkGroupSizing::FitToMaxThreads(LocalSizes, work_dim, global_work_size);
+    }
+
+    WorkGroupTuner::Sample TuningSample;
+    if (!local_work_size && !RequiredDims && !DimsHint && WorkGroupTuner::IsEnabled())
+    {
+        queue.GetD3DDevice().GetWorkGroupTuner().Choose(kernel.GetTuningIdentity(), work_dim, global_work_size, LocalSizes, TuningSample);
     }
 
     for (cl_uint i = 0; i < work_dim; ++i)
@@ -451,7 +760,7 @@ clEnqueueNDRangeKernel(cl_command_queue command_queue,
 
     try
     {
-        std::unique_ptr<Task> task(new ExecuteKernel(kernel, command_queue, DispatchDimensions, GlobalWorkItemOffsets, LocalSizes, work_dim));
+        std::unique_ptr<Task> task(new ExecuteKernel(kernel, command_queue, DispatchDimensions, GlobalWorkItemOffsets, LocalSizes, work_dim, TuningSample));
 
         auto Lock = g_Platform->GetTaskPoolLock();
         task->AddDependencies(event_wait_list, num_events_in_wait_list, Lock);
@@ -511,15 +820,31 @@ constexpr UINT c_NumConstants[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT]
     D3D11_REQ_CONSTANT_BUFFER_ELEMENT_COUNT, D3D11_REQ_CONSTANT_BUFFER_ELEMENT_COUNT
 };
 
+// Binds a table of views starting at slot 0, unbinding any slots past its end that the previously
+// bound table was using, so that a previous kernel's resources don't stay bound to this one.
+template <typename TView, typename TSetter>
+static void BindViewTable(std::vector<TView*> const& Table, std::vector<TView*> const* Previous, TSetter&& Set)
+{
+    if (Previous && Previous->size() > Table.size())
+    {
+        std::vector<TView*> Padded(Table);
+        Padded.resize(Previous->size(), nullptr);
+        Set((UINT)Padded.size(), Padded.data());
+    }
+    else
+    {
+        Set((UINT)Table.size(), Table.data());
+    }
+}
+
 void ExecuteKernel::RecordImpl()
 {
-    std::unique_lock lock(m_SpecializeLock);
-    while (!m_Specialized && !m_SpecializeError)
+    if (!m_Specialized)
     {
-        m_SpecializeEvent.wait(lock);
+        m_Specialized = m_PendingSpecialization->Wait();
     }
 
-    if (m_SpecializeError)
+    if (!m_Specialized)
     {
         auto Lock = g_Platform->GetTaskPoolLock();
         Complete(CL_BUILD_PROGRAM_FAILURE, Lock);
@@ -527,19 +852,59 @@ void ExecuteKernel::RecordImpl()
     }
 
     auto& Device = m_CommandQueue->GetD3DDevice();
-    std::transform(m_KernelArgUAVs.begin(), m_KernelArgUAVs.end(), m_UAVs.begin(), [&Device](Resource::ref_ptr_int& resource) { return resource.Get() ? &resource->GetUAV(&Device) : nullptr; });
-    std::transform(m_KernelArgSRVs.begin(), m_KernelArgSRVs.end(), m_SRVs.begin(), [&Device](Resource::ref_ptr_int& resource) { return resource.Get() ? &resource->GetSRV(&Device) : nullptr; });
-    std::transform(m_KernelArgSamplers.begin(), m_KernelArgSamplers.end(), m_Samplers.begin(), [&Device](Sampler::ref_ptr_int& sampler) { return sampler.Get() ? &sampler->GetUnderlying(&Device) : nullptr; });
-    if (m_PrintfUAV.Get())
+    auto& ViewState = Device.GetComputeViewState();
+    ComputeViewTables Views = m_Bindings->Resolve(Device);
+    auto& ImmCtx = Device.ImmCtx();
+    if (m_PrintfBuffer)
     {
-        m_UAVs[m_Kernel->m_Dxil.GetMetadata().printf_uav_id] = &m_PrintfUAV->GetUAV(&Device);
+        // Printf buffers are recycled per execution, so this table is specific to this one
+        auto UAVs = *Views.m_UAVs;
+        UAVs[m_Kernel->m_Dxil.GetMetadata().printf_uav_id] = m_PrintfBuffer->m_UAV.get();
+        Views.m_UAVs = ViewState.m_UAVTables.Intern(UAVs.data(), UAVs.size());
+
+        // The buffer may be recycled from a previous dispatch, but the kernel only appends
+        // after the header, so resetting the write offset is all that's needed.
+        const uint32_t Header[2] = { sizeof(uint32_t) * 2, m_PrintfBuffer->m_Size };
+        D3D11_SUBRESOURCE_DATA HeaderData = { Header, sizeof(Header), sizeof(Header) };
+        D3D12_BOX HeaderBox = { 0, 0, 0, sizeof(Header), 1, 1 };
+        ImmCtx.UpdateSubresources(
+            m_PrintfBuffer->m_Resource.get(),
+            m_PrintfBuffer->m_Resource->GetFullSubresourceSubset(),
+            &HeaderData,
+            &HeaderBox,
+            D3D12TranslationLayer::ImmediateContext::UpdateSubresourcesFlags::ScenarioImmediateContext);
     }
 
-    auto& ImmCtx = Device.ImmCtx();
-    ImmCtx.CsSetUnorderedAccessViews(0, (UINT)m_UAVs.size(), m_UAVs.data(), c_aUAVAppendOffsets);
-    ImmCtx.SetShaderResources<D3D12TranslationLayer::e_CS>(0, (UINT)m_SRVs.size(), m_SRVs.data());
-    ImmCtx.SetSamplers<D3D12TranslationLayer::e_CS>(0, (UINT)m_Samplers.size(), m_Samplers.data());
-    ImmCtx.SetPipelineState(m_Specialized->m_PSO.get());
+    // Views stay bound across executions within a submission, so when the tables match the previous
+    // execution's there's nothing to do, and the translation layer reuses the descriptor tables it
+    // already built for them.
+    if (Views.m_UAVs != ViewState.m_Bound.m_UAVs)
+    {
+        BindViewTable(*Views.m_UAVs, ViewState.m_Bound.m_UAVs.get(), [&ImmCtx](UINT Count, D3D12TranslationLayer::UAV* const* pViews)
+        {
+            ImmCtx.CsSetUnorderedAccessViews(0, Count, pViews, c_aUAVAppendOffsets);
+        });
+    }
+    if (Views.m_SRVs != ViewState.m_Bound.m_SRVs)
+    {
+        BindViewTable(*Views.m_SRVs, ViewState.m_Bound.m_SRVs.get(), [&ImmCtx](UINT Count, D3D12TranslationLayer::SRV* const* pViews)
+        {
+            ImmCtx.SetShaderResources<D3D12TranslationLayer::e_CS>(0, Count, pViews);
+        });
+    }
+    if (Views.m_Samplers != ViewState.m_Bound.m_Samplers)
+    {
+        BindViewTable(*Views.m_Samplers, ViewState.m_Bound.m_Samplers.get(), [&ImmCtx](UINT Count, D3D12TranslationLayer::Sampler* const* pViews)
+        {
+            ImmCtx.SetSamplers<D3D12TranslationLayer::e_CS>(0, Count, pViews);
+        });
+    }
+    ViewState.m_Bound = std::move(Views);
+    if (ViewState.m_BoundPSO != m_Specialized->m_PSO.get())
+    {
+        ImmCtx.SetPipelineState(m_Specialized->m_PSO.get());
+        ViewState.m_BoundPSO = m_Specialized->m_PSO.get();
+    }
 
     // Fill out offsets that'll be read by the kernel for local arg pointers, based on the offsets
     // returned by the compiler for this specialization
@@ -560,6 +925,28 @@ void ExecuteKernel::RecordImpl()
         nullptr,
         D3D12TranslationLayer::ImmediateContext::UpdateSubresourcesFlags::ScenarioInitialData);
 
+    if (m_TuningSample.IsValid())
+    {
+        try
+        {
+            m_TuningStart.reset(new D3D12TranslationLayer::Query(
+                &ImmCtx, D3D12TranslationLayer::e_QUERY_TIMESTAMP, D3D12TranslationLayer::COMMAND_LIST_TYPE_GRAPHICS_MASK
+            ));
+            m_TuningStart->Initialize();
+            m_TuningStop.reset(new D3D12TranslationLayer::Query(
+                &ImmCtx, D3D12TranslationLayer::e_QUERY_TIMESTAMP, D3D12TranslationLayer::COMMAND_LIST_TYPE_GRAPHICS_MASK
+            ));
+            m_TuningStop->Initialize();
+            ImmCtx.QueryEnd(m_TuningStart.get());
+        }
+        catch (...)
+        {
+            // Just don't contribute a sample
+            m_TuningStart.reset();
+            m_TuningStop.reset();
+        }
+    }
+
     cl_uint numXIterations = ((m_DispatchDims[0] - 1) / D3D12_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION) + 1;
     cl_uint numYIterations = ((m_DispatchDims[1] - 1) / D3D12_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION) + 1;
     cl_uint numZIterations = ((m_DispatchDims[2] - 1) / D3D12_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION) + 1;
@@ -583,21 +970,44 @@ void ExecuteKernel::RecordImpl()
         }
     }
 
-    ImmCtx.ClearState();
+    if (m_TuningStop)
+    {
+        ImmCtx.QueryEnd(m_TuningStop.get());
+    }
 }
 
 void ExecuteKernel::OnComplete()
 {
     auto Cleanup = wil::scope_exit([this]()
     {
+        if (m_PrintfBuffer)
+        {
+            m_CommandQueue->GetD3DDevice().ReturnPrintfBuffer(std::move(m_PrintfBuffer));
+        }
+        m_TuningStart.reset();
+        m_TuningStop.reset();
         m_Kernel.Release();
     });
 
-    if (m_PrintfUAV.Get())
+    if (m_TuningStart && m_TuningStop)
+    {
+        auto& Device = m_CommandQueue->GetD3DDevice();
+        UINT64 Frequency = Device.GetTimestampFrequency();
+        UINT64 Start, Stop;
+        if (m_TuningStart->GetData(&Start, sizeof(Start), true, false) &&
+            m_TuningStop->GetData(&Stop, sizeof(Stop), true, false) &&
+            Stop >= Start)
+        {
+            Device.GetWorkGroupTuner().ReportSample(m_TuningSample, TimestampToNanoseconds(Stop - Start, Frequency));
+        }
+    }
+
+    if (m_PrintfBuffer)
     {
         auto& Device = m_CommandQueue->GetD3DDevice();
         auto& ImmCtx = Device.ImmCtx();
-        auto TranslationResource = m_PrintfUAV->GetUnderlyingResource(&Device);
+        auto TranslationResource = m_PrintfBuffer->m_Resource.get();
+        const uint32_t PrintfBufferSize = m_PrintfBuffer->m_Size;
         D3D12TranslationLayer::MappedSubresource MapRet = {};
         ImmCtx.Map(TranslationResource, 0, D3D12TranslationLayer::MAP_TYPE_READ, false, nullptr, &MapRet);
 
@@ -606,274 +1016,28 @@ void ExecuteKernel::OnComplete()
             ImmCtx.Unmap(TranslationResource, 0, D3D12TranslationLayer::MAP_TYPE_READ, nullptr);
         });
 
-        // The buffer has a two-uint header.
-        constexpr uint32_t InitialBufferOffset = sizeof(uint32_t) * 2;
         // The first uint is the offset where the next chunk of data would be written. Alternatively,
         // it's the size of the buffer that's *been* written, including the size of the header.
+        // If it's past the end of the buffer, some output was dropped.
         uint32_t NumBytesWritten = *reinterpret_cast<uint32_t*>(MapRet.pData);
-        uint32_t CurOffset = InitialBufferOffset;
-
-        std::byte* ByteStream = reinterpret_cast<std::byte*>(MapRet.pData);
-        while (CurOffset < NumBytesWritten && CurOffset < PrintfBufferSize)
-        {
-            uint32_t FormatStringId = *reinterpret_cast<uint32_t*>(ByteStream + CurOffset);
-            assert(FormatStringId <= m_Kernel->m_Dxil.GetMetadata().printfs.size());
-            if (FormatStringId == 0)
-                break;
+        uint32_t ValidSize = std::min(NumBytesWritten, PrintfBufferSize);
 
-            auto& PrintfData = m_Kernel->m_Dxil.GetMetadata().printfs[FormatStringId - 1];
-            CurOffset += sizeof(FormatStringId);
-            auto StructBeginOffset = CurOffset;
-            uint32_t OffsetInStruct = 0;
+        // Only copy the data out while holding the task pool lock, formatting happens on the printf worker.
+        std::byte const* ByteStream = reinterpret_cast<std::byte const*>(MapRet.pData);
+        std::vector<std::byte> Data(ByteStream, ByteStream + ValidSize);
+        Unmap.reset();
 
-            uint32_t ArgIdx = 0;
-            uint32_t TotalArgSize = std::accumulate(PrintfData.arg_sizes,
-                                                    PrintfData.arg_sizes + PrintfData.num_args,
-                                                    0u);
-            TotalArgSize = D3D12TranslationLayer::Align<uint32_t>(TotalArgSize, 4);
-
-            if (CurOffset + TotalArgSize > PrintfBufferSize)
-                break;
-
-            std::ostringstream stream;
-            const char* SectionStart = PrintfData.str;
-            while (const char* SectionEnd = strchr(SectionStart, '%'))
+        g_Platform->GetPrintfOutput().QueueOutput(
+            [Data = std::move(Data), kernel = m_Kernel]()
             {
-                if (SectionEnd[1] == '%')
-                {
-                    stream << std::string_view(SectionStart, SectionEnd - SectionStart + 2);
-                    SectionStart = SectionEnd + 2;
-                    continue;
-                }
-                stream << std::string_view(SectionStart, SectionEnd - SectionStart);
-
-                // Parse the printf declaration to find what type we should load
-                char FinalFormatString[16] = "%", *OutputFormatString = FinalFormatString + 1;
-                const char* FormatStr = SectionEnd + 1;
-                for (; *FormatStr; ++FormatStr)
-                {
-                    switch (*FormatStr)
-                    {
-                    case '+':
-                    case '-':
-                    case ' ':
-                    case '#':
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                    case '.':
-                        // Flag, field width, or precision
-                        *(OutputFormatString++) = *FormatStr;
-                        continue;
-                    }
-                    break;
-                }
-
-                uint32_t VectorSize = 1;
-                if (*FormatStr == 'v')
+                std::string Output;
+                if (kernel->m_PrintfPlans)
                 {
-                    ++FormatStr;
-                    switch (*FormatStr)
-                    {
-                    case '2': VectorSize = 2; break;
-                    case '3': VectorSize = 3; break;
-                    case '4': VectorSize = 4; break;
-                    case '8': VectorSize = 8; break;
-                    case '1':
-                        ++FormatStr;
-                        if (*FormatStr == '6')
-                        {
-                            VectorSize = 16;
-                            break;
-                        }
-                        // fallthrough
-                    default:
-                        printf("Invalid format string, unexpected vector size.\n");
-                        return;
-                    }
-                    ++FormatStr;
-                }
-
-                uint32_t DataSize = 4;
-                bool ExplicitDataSize = false;
-                switch (*FormatStr)
-                {
-                case 'h':
-                    ExplicitDataSize = true;
-                    ++FormatStr;
-                    if (*FormatStr == 'h')
-                    {
-                        DataSize = 1;
-                        *(OutputFormatString++) = 'h';
-                        *(OutputFormatString++) = 'h';
-                        ++FormatStr;
-                    }
-                    else if (*FormatStr == 'l')
-                    {
-                        if (VectorSize == 1)
-                        {
-                            printf("Invalid format string, hl precision only valid with vectors.\n");
-                            return;
-                        }
-                        DataSize = 4;
-                        ++FormatStr;
-                    }
-                    else
-                    {
-                        *(OutputFormatString++) = 'h';
-                        DataSize = 2;
-                    }
-                    break;
-                case 'l':
-                    ExplicitDataSize = true;
-                    *(OutputFormatString++) = 'l';
-                    ++FormatStr;
-                    DataSize = 8;
-                    break;
+                    DecodePrintfBuffer(*kernel->m_PrintfPlans, Data.data(), (uint32_t)Data.size(), Output);
                 }
-
-                if (!ExplicitDataSize && VectorSize > 1)
-                {
-                    printf("Invalid format string, vectors require explicit data size.\n");
-                    return;
-                }
-
-                *(OutputFormatString++) = *FormatStr;
-                if (!ExplicitDataSize)
-                {
-                    switch (*FormatStr)
-                    {
-                    case 's':
-                    case 'p':
-                        // Pointers are 64bit
-                        DataSize = 8;
-                        break;
-                    }
-                }
-
-                // Get the base pointer to the arg, now that we know how big it is
-                uint32_t ArgSize = DataSize * (VectorSize == 3 ? 4 : VectorSize);
-                assert(ArgSize == PrintfData.arg_sizes[ArgIdx]);
-                uint32_t ArgOffset = D3D12TranslationLayer::Align<uint32_t>(OffsetInStruct, 4) + StructBeginOffset;
-                std::byte* ArgPtr = ByteStream + ArgOffset;
-                OffsetInStruct += ArgSize;
-
-                std::string StringBuffer;
-                StringBuffer.resize(32);
-                for (uint32_t i = 0; i < VectorSize; ++i)
-                {
-                    switch (*FormatStr)
-                    {
-                    default:
-                        printf("Invalid format string, unknown conversion specifier.\n");
-                        return;
-                    case 's':
-                    {
-                        if (DataSize != 8 || VectorSize != 1)
-                        {
-                            printf("Invalid format string, precision or vector applied to string.\n");
-                            return;
-                        }
-                        uint64_t StringId = *reinterpret_cast<uint64_t*>(ArgPtr);
-                        const char *Str = &PrintfData.str[StringId];
-                        // Use sprintf to deal with precision potentially shortening how much is printed
-                        StringBuffer.resize(snprintf(nullptr, 0, FinalFormatString, Str) + 1);
-                        sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString, Str);
-                        break;
-                    }
-                    case 'f':
-                    case 'F':
-                    case 'e':
-                    case 'E':
-                    case 'g':
-                    case 'G':
-                    case 'a':
-                    case 'A':
-                    {
-                        if (ExplicitDataSize && DataSize != 4)
-                        {
-                            printf("Invalid format string, floats other than 4 bytes are not supported.\n");
-                            return;
-                        }
-                        float val = *reinterpret_cast<float*>(ArgPtr);
-                        sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString, val);
-                        break;
-                    }
-                    break;
-                    case 'c':
-                        DataSize = 1;
-                        // fallthrough
-                    case 'd':
-                    case 'i':
-                        switch (DataSize)
-                        {
-                        case 1:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<int8_t*>(ArgPtr));
-                            break;
-                        case 2:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<int16_t*>(ArgPtr));
-                            break;
-                        case 4:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<int32_t*>(ArgPtr));
-                            break;
-                        case 8:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<int64_t*>(ArgPtr));
-                            break;
-                        }
-                        break;
-                    case 'o':
-                    case 'u':
-                    case 'x':
-                    case 'X':
-                    case 'p':
-                        switch (DataSize)
-                        {
-                        case 1:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<uint8_t*>(ArgPtr));
-                            break;
-                        case 2:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<uint16_t*>(ArgPtr));
-                            break;
-                        case 4:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<uint32_t*>(ArgPtr));
-                            break;
-                        case 8:
-                            sprintf_s(StringBuffer.data(), StringBuffer.size(), FinalFormatString,
-                                      *reinterpret_cast<uint64_t*>(ArgPtr));
-                            break;
-                        }
-                        break;
-                    }
-
-                    ArgPtr += DataSize;
-                    stream << StringBuffer.c_str();
-                    if (i < VectorSize - 1)
-                        stream << ",";
-                }
-
-                SectionStart = FormatStr + 1;
-                ArgIdx++;
-            }
-
-            stream << SectionStart;
-            printf("%s", stream.str().c_str());
-            fflush(stdout);
-
-            CurOffset += TotalArgSize;
-        }
+                return Output;
+            },
+            m_Parent->GetPrintfCallback(),
+            NumBytesWritten <= PrintfBufferSize);
     }
 }
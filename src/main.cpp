@@ -50,6 +50,9 @@ static struct ExtensionTableEntry clExtensions[] =
 
     // cl_khr_il_program
     EXT_FUNC(clCreateProgramWithILKHR),
+
+    // cl_msft_set_kernel_args
+    EXT_FUNC(clSetKernelArgsMSFT),
 };
 
 static const int clExtensionCount = sizeof(clExtensions) / sizeof(clExtensions[0]);
@@ -3,6 +3,8 @@
 #include "platform.hpp"
 #include "cache.hpp"
 #include "compiler.hpp"
+#include "printf.hpp"
+#include <dxc/dxcapi.h>
 
 CL_API_ENTRY cl_int CL_API_CALL
 clGetPlatformInfo(cl_platform_id   platform,
@@ -60,6 +62,8 @@ clGetPlatformInfo(cl_platform_id   platform,
             { CL_MAKE_VERSION(1, 0, 0), "cl_khr_3d_image_writes" },
             { CL_MAKE_VERSION(1, 0, 0), "cl_khr_gl_sharing" },
             { CL_MAKE_VERSION(1, 0, 0), "cl_khr_gl_event" },
+            { CL_MAKE_VERSION(1, 0, 0), "cl_arm_printf" },
+            { CL_MAKE_VERSION(1, 0, 0), "cl_msft_set_kernel_args" },
         };
         return CopyOutParameter(extensions, param_value_size, param_value, param_value_size_ret);
     }
@@ -113,6 +117,7 @@ clUnloadPlatformCompiler(cl_platform_id platform) CL_API_SUFFIX__VERSION_1_2
 
 #include "device.hpp"
 Platform::Platform(cl_icd_dispatch* dispatch)
+    : m_PrintfOutput(new PrintfOutput)
 {
     this->dispatch = dispatch;
 
@@ -154,6 +159,19 @@ Platform::Platform(cl_icd_dispatch* dispatch)
     {
         m_Devices.resize(1);
     }
+
+    char *printfBufferSizeStr = nullptr;
+    if (_dupenv_s(&printfBufferSizeStr, nullptr, "CLON12_PRINTF_BUFFER_SIZE") == 0 &&
+        printfBufferSizeStr)
+    {
+        // Needs to at least fit the header, and stay dword-aligned for the raw UAV
+        unsigned long printfBufferSize = strtoul(printfBufferSizeStr, nullptr, 0);
+        if (printfBufferSize >= sizeof(uint32_t) * 4 && printfBufferSize <= UINT_MAX)
+        {
+            m_PrintfBufferSize = (uint32_t)printfBufferSize & ~3u;
+        }
+    }
+    free(printfBufferSizeStr);
 }
 
 Platform::~Platform() = default;
@@ -194,8 +212,13 @@ void Platform::DeviceInit()
     BackgroundTaskScheduler::SchedulingMode mode{ 1u, BackgroundTaskScheduler::Priority::Normal };
     m_CallbackScheduler.SetSchedulingMode(mode);
 
+    m_PrintfOutput->SetSchedulingMode(mode);
+
     mode.NumThreads = std::thread::hardware_concurrency();
     m_CompileAndLinkScheduler.SetSchedulingMode(mode);
+
+    mode.ThreadPriority = BackgroundTaskScheduler::Priority::Idle;
+    m_BackgroundCompileScheduler.SetSchedulingMode(mode);
 }
 
 void Platform::DeviceUninit()
@@ -209,6 +232,8 @@ void Platform::DeviceUninit()
     BackgroundTaskScheduler::SchedulingMode mode{ 0u, BackgroundTaskScheduler::Priority::Normal };
     m_CallbackScheduler.SetSchedulingMode(mode);
     m_CompileAndLinkScheduler.SetSchedulingMode(mode);
+    m_BackgroundCompileScheduler.SetSchedulingMode(mode);
+    m_PrintfOutput->SetSchedulingMode(mode);
 }
 
 #ifdef _WIN32
@@ -265,6 +290,61 @@ XPlatHelpers::unique_module const& Platform::GetDXIL()
     return m_DXIL;
 }
 
+ComPtr<IDxcValidator> Platform::AcquireDxilValidator()
+{
+    {
+        std::lock_guard lock(m_DxilValidatorLock);
+        if (!m_DxilValidators.empty())
+        {
+            ComPtr<IDxcValidator> spValidator = std::move(m_DxilValidators.back());
+            m_DxilValidators.pop_back();
+            return spValidator;
+        }
+    }
+
+    auto& DXIL = GetDXIL();
+    auto pfnCreateInstance = DXIL ? DXIL.proc_address<decltype(&DxcCreateInstance)>("DxcCreateInstance") : nullptr;
+    ComPtr<IDxcValidator> spValidator;
+    if (!pfnCreateInstance ||
+        FAILED(pfnCreateInstance(CLSID_DxcValidator, IID_PPV_ARGS(&spValidator))))
+        return nullptr;
+    return spValidator;
+}
+
+void Platform::ReturnDxilValidator(ComPtr<IDxcValidator> spValidator) noexcept
+{
+    if (!spValidator)
+        return;
+    try
+    {
+        std::lock_guard lock(m_DxilValidatorLock);
+        m_DxilValidators.push_back(std::move(spValidator));
+    }
+    catch (std::bad_alloc&) {} // The next acquire just creates a new one
+}
+
+bool Platform::GetDxilValidatorVersion(UINT32& Major, UINT32& Minor)
+{
+    std::call_once(m_DxilValidatorVersionOnce, [this]()
+    {
+        ComPtr<IDxcValidator> spValidator = AcquireDxilValidator();
+        ComPtr<IDxcVersionInfo> spVersionInfo;
+        if (spValidator && SUCCEEDED(spValidator.As(&spVersionInfo)))
+        {
+            UINT32 major = 0, minor = 0;
+            if (SUCCEEDED(spVersionInfo->GetVersion(&major, &minor)))
+            {
+                m_DxilValidatorMajor = major;
+                m_DxilValidatorMinor = minor;
+            }
+        }
+        ReturnDxilValidator(std::move(spValidator));
+    });
+    Major = m_DxilValidatorMajor;
+    Minor = m_DxilValidatorMinor;
+    return Major != 0 || Minor != 0;
+}
+
 void Platform::UnloadCompiler()
 {
     // If we want to actually support unloading the compiler,
@@ -0,0 +1,409 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#include "printf.hpp"
+
+#include <wil/resource.h>
+#include <numeric>
+
+PrintfFormatPlan::PrintfFormatPlan(CompiledDxil::Metadata::Printf const& printf)
+    : m_StringTable(printf.str)
+{
+    m_TotalArgSize = std::accumulate(printf.arg_sizes, printf.arg_sizes + printf.num_args, 0u);
+    m_TotalArgSize = D3D12TranslationLayer::Align<uint32_t>(m_TotalArgSize, 4);
+
+    uint32_t ArgIdx = 0;
+    uint32_t OffsetInStruct = 0;
+    std::string Literal;
+    const char* SectionStart = printf.str;
+    while (const char* SectionEnd = strchr(SectionStart, '%'))
+    {
+        if (SectionEnd[1] == '%')
+        {
+            Literal.append(SectionStart, SectionEnd + 1);
+            SectionStart = SectionEnd + 2;
+            continue;
+        }
+        Literal.append(SectionStart, SectionEnd);
+
+        // Parse the printf declaration to find what type we should load
+        Conversion Conv = {};
+        char* OutputFormatString = Conv.Format;
+        char* const OutputFormatStringEnd = std::end(Conv.Format) - 4; // Room for size modifiers, conversion and null
+        *(OutputFormatString++) = '%';
+        const char* FormatStr = SectionEnd + 1;
+        for (; *FormatStr; ++FormatStr)
+        {
+            switch (*FormatStr)
+            {
+            case '+':
+            case '-':
+            case ' ':
+            case '#':
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9':
+            case '.':
+                // Flag, field width, or precision
+                if (OutputFormatString == OutputFormatStringEnd)
+                {
+                    m_Error = "Invalid format string, flags, width, or precision too long.\n";
+                    break;
+                }
+                *(OutputFormatString++) = *FormatStr;
+                continue;
+            }
+            break;
+        }
+        if (m_Error)
+            break;
+
+        uint32_t VectorSize = 1;
+        if (*FormatStr == 'v')
+        {
+            ++FormatStr;
+            switch (*FormatStr)
+            {
+            case '2': VectorSize = 2; break;
+            case '3': VectorSize = 3; break;
+            case '4': VectorSize = 4; break;
+            case '8': VectorSize = 8; break;
+            case '1':
+                ++FormatStr;
+                if (*FormatStr == '6')
+                {
+                    VectorSize = 16;
+                    break;
+                }
+                // fallthrough
+            default:
+                m_Error = "Invalid format string, unexpected vector size.\n";
+                break;
+            }
+            if (m_Error)
+                break;
+            ++FormatStr;
+        }
+
+        uint32_t DataSize = 4;
+        bool ExplicitDataSize = false;
+        switch (*FormatStr)
+        {
+        case 'h':
+            ExplicitDataSize = true;
+            ++FormatStr;
+            if (*FormatStr == 'h')
+            {
+                DataSize = 1;
+                *(OutputFormatString++) = 'h';
+                *(OutputFormatString++) = 'h';
+                ++FormatStr;
+            }
+            else if (*FormatStr == 'l')
+            {
+                if (VectorSize == 1)
+                {
+                    m_Error = "Invalid format string, hl precision only valid with vectors.\n";
+                    break;
+                }
+                DataSize = 4;
+                ++FormatStr;
+            }
+            else
+            {
+                *(OutputFormatString++) = 'h';
+                DataSize = 2;
+            }
+            break;
+        case 'l':
+            ExplicitDataSize = true;
+            *(OutputFormatString++) = 'l';
+            ++FormatStr;
+            DataSize = 8;
+            break;
+        }
+        if (m_Error)
+            break;
+
+        if (!ExplicitDataSize && VectorSize > 1)
+        {
+            m_Error = "Invalid format string, vectors require explicit data size.\n";
+            break;
+        }
+
+        *(OutputFormatString++) = *FormatStr;
+        *OutputFormatString = '\0';
+        if (!ExplicitDataSize)
+        {
+            switch (*FormatStr)
+            {
+            case 's':
+            case 'p':
+                // Pointers are 64bit
+                DataSize = 8;
+                break;
+            }
+        }
+
+        // The argument's location in the buffer is based on the declared size, but chars are
+        // read back as a single byte regardless of how they were promoted.
+        uint32_t ArgSize = DataSize * (VectorSize == 3 ? 4 : VectorSize);
+        assert(ArgIdx < printf.num_args && ArgSize == printf.arg_sizes[ArgIdx]);
+        Conv.ArgOffset = D3D12TranslationLayer::Align<uint32_t>(OffsetInStruct, 4);
+        OffsetInStruct += ArgSize;
+        Conv.VectorSize = (uint8_t)VectorSize;
+        Conv.ElementSize = (uint8_t)DataSize;
+
+        switch (*FormatStr)
+        {
+        case 's':
+            if (DataSize != 8 || VectorSize != 1)
+            {
+                m_Error = "Invalid format string, precision or vector applied to string.\n";
+                break;
+            }
+            Conv.Kind = ConversionKind::String;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (ExplicitDataSize && DataSize != 4)
+            {
+                m_Error = "Invalid format string, floats other than 4 bytes are not supported.\n";
+                break;
+            }
+            Conv.Kind = ConversionKind::Float;
+            break;
+        case 'c':
+            Conv.ElementSize = 1;
+            // fallthrough
+        case 'd':
+        case 'i':
+            Conv.Kind = ConversionKind::Signed;
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'p':
+            Conv.Kind = ConversionKind::Unsigned;
+            break;
+        default:
+            m_Error = "Invalid format string, unknown conversion specifier.\n";
+            break;
+        }
+        if (m_Error)
+            break;
+
+        m_Sections.push_back({ std::move(Literal), true, Conv });
+        Literal.clear();
+
+        SectionStart = FormatStr + 1;
+        ArgIdx++;
+    }
+
+    if (!m_Error)
+    {
+        Literal.append(SectionStart);
+        m_Sections.push_back({ std::move(Literal), false, {} });
+    }
+}
+
+template <typename T>
+static void AppendFormatted(std::string& Output, const char* Format, T Value)
+{
+    char Buffer[64];
+    int Length = snprintf(Buffer, sizeof(Buffer), Format, Value);
+    if (Length < 0)
+        return;
+    if ((size_t)Length < sizeof(Buffer))
+    {
+        Output.append(Buffer, Length);
+        return;
+    }
+
+    // Wide fields or large values, format directly into the output
+    size_t Start = Output.size();
+    Output.resize(Start + Length + 1);
+    snprintf(Output.data() + Start, Length + 1, Format, Value);
+    Output.resize(Start + Length);
+}
+
+template <typename T>
+static T ReadArg(std::byte const* Ptr)
+{
+    T Value;
+    memcpy(&Value, Ptr, sizeof(T));
+    return Value;
+}
+
+bool PrintfFormatPlan::Decode(std::byte const* ArgData, std::string& Output) const
+{
+    if (m_Error)
+    {
+        // Matches the legacy behavior of discarding the whole record
+        Output.append(m_Error);
+        return false;
+    }
+
+    for (auto& Section : m_Sections)
+    {
+        Output.append(Section.Literal);
+        if (!Section.HasConversion)
+            continue;
+
+        auto& Conv = Section.Conv;
+        std::byte const* ArgPtr = ArgData + Conv.ArgOffset;
+        for (uint32_t i = 0; i < Conv.VectorSize; ++i)
+        {
+            switch (Conv.Kind)
+            {
+            case ConversionKind::String:
+                // Use snprintf to deal with precision potentially shortening how much is printed
+                AppendFormatted(Output, Conv.Format, &m_StringTable[ReadArg<uint64_t>(ArgPtr)]);
+                break;
+            case ConversionKind::Float:
+                AppendFormatted(Output, Conv.Format, ReadArg<float>(ArgPtr));
+                break;
+            case ConversionKind::Signed:
+                switch (Conv.ElementSize)
+                {
+                case 1: AppendFormatted(Output, Conv.Format, ReadArg<int8_t>(ArgPtr)); break;
+                case 2: AppendFormatted(Output, Conv.Format, ReadArg<int16_t>(ArgPtr)); break;
+                case 4: AppendFormatted(Output, Conv.Format, ReadArg<int32_t>(ArgPtr)); break;
+                case 8: AppendFormatted(Output, Conv.Format, ReadArg<int64_t>(ArgPtr)); break;
+                }
+                break;
+            case ConversionKind::Unsigned:
+                switch (Conv.ElementSize)
+                {
+                case 1: AppendFormatted(Output, Conv.Format, ReadArg<uint8_t>(ArgPtr)); break;
+                case 2: AppendFormatted(Output, Conv.Format, ReadArg<uint16_t>(ArgPtr)); break;
+                case 4: AppendFormatted(Output, Conv.Format, ReadArg<uint32_t>(ArgPtr)); break;
+                case 8: AppendFormatted(Output, Conv.Format, ReadArg<uint64_t>(ArgPtr)); break;
+                }
+                break;
+            }
+
+            ArgPtr += Conv.ElementSize;
+            if (i < Conv.VectorSize - 1u)
+                Output.push_back(',');
+        }
+    }
+    return true;
+}
+
+PrintfFormatPlans CreatePrintfFormatPlans(CompiledDxil::Metadata const& metadata)
+{
+    PrintfFormatPlans plans;
+    plans.reserve(metadata.printfs.size());
+    for (auto& printf : metadata.printfs)
+    {
+        plans.emplace_back(printf);
+    }
+    return plans;
+}
+
+void DecodePrintfBuffer(PrintfFormatPlans const& plans, std::byte const* Data, uint32_t Size, std::string& Output)
+{
+    // The buffer has a two-uint header.
+    constexpr uint32_t InitialBufferOffset = sizeof(uint32_t) * 2;
+    uint32_t CurOffset = InitialBufferOffset;
+
+    while (CurOffset + sizeof(uint32_t) <= Size)
+    {
+        uint32_t FormatStringId = ReadArg<uint32_t>(Data + CurOffset);
+        assert(FormatStringId <= plans.size());
+        if (FormatStringId == 0 || FormatStringId > plans.size())
+            break;
+
+        auto& Plan = plans[FormatStringId - 1];
+        CurOffset += sizeof(FormatStringId);
+        if (CurOffset + Plan.GetTotalArgSize() > Size)
+            break;
+
+        if (!Plan.Decode(Data + CurOffset, Output))
+            break;
+
+        CurOffset += Plan.GetTotalArgSize();
+    }
+}
+
+PrintfOutput::PrintfOutput()
+{
+    char *fileName = nullptr;
+    if (_dupenv_s(&fileName, nullptr, "CLON12_PRINTF_FILE") == 0 && fileName && *fileName)
+    {
+        FILE* file = nullptr;
+        if (fopen_s(&file, fileName, "a") == 0 && file)
+        {
+            m_File = file;
+            m_OwnsFile = true;
+        }
+    }
+    free(fileName);
+}
+
+PrintfOutput::~PrintfOutput()
+{
+    m_Scheduler.Shutdown();
+    if (m_OwnsFile)
+    {
+        fclose(m_File);
+    }
+}
+
+// Set while the app's callback is running, in case it calls back into the runtime
+// and tries to wait for its own output.
+static thread_local bool t_InPrintfCallback = false;
+
+void PrintfOutput::Write(std::string const& Text, Callback const& callback, bool Complete)
+{
+    if (callback.m_pfn)
+    {
+        t_InPrintfCallback = true;
+        auto Reset = wil::scope_exit([]() { t_InPrintfCallback = false; });
+        callback.m_pfn(Text.c_str(), Text.size(), Complete ? 1 : 0, callback.m_UserData);
+        return;
+    }
+
+    if (Text.empty())
+        return;
+    fwrite(Text.data(), 1, Text.size(), m_File);
+    fflush(m_File);
+}
+
+void PrintfOutput::Retire() noexcept
+{
+    {
+        std::lock_guard lock(m_Lock);
+        ++m_NumRetired;
+    }
+    m_RetiredEvent.notify_all();
+}
+
+uint64_t PrintfOutput::GetQueuedPosition()
+{
+    std::lock_guard lock(m_Lock);
+    return m_NumQueued;
+}
+
+void PrintfOutput::WaitFor(uint64_t Position)
+{
+    if (t_InPrintfCallback)
+        return;
+
+    std::unique_lock lock(m_Lock);
+    m_RetiredEvent.wait(lock, [this, Position]() { return m_NumRetired >= Position; });
+}
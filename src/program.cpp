@@ -3,8 +3,11 @@
 #include "program.hpp"
 #include "compiler.hpp"
 #include "kernel.hpp"
+#include "hash.hpp"
 
 #include <algorithm>
+#include <string_view>
+#include <tuple>
 
 struct ProgramBinaryHeader
 {
@@ -35,6 +38,66 @@ struct ProgramBinaryHeader
     const void* GetBinary() const { return this + 1; }
 };
 
+// Optionally follows the SPIR-V of an executable, carrying the generic DXIL for each of its kernels.
+// Binaries without it are still valid, and it's ignored when it comes from a different compiler.
+struct ProgramBinaryDxilSection
+{
+    static constexpr GUID c_ValidSectionGuid = { /* 8d0b5f27-c1e4-4a96-b3d8-2e7f6a19c054 */
+        0x8d0b5f27, 0xc1e4, 0x4a96, {0xb3, 0xd8, 0x2e, 0x7f, 0x6a, 0x19, 0xc0, 0x54} };
+    GUID SectionGuid = c_ValidSectionGuid;
+    uint64_t CompilerVersion = 0;
+    uint32_t NumKernels = 0;
+    uint32_t Padding = 0;
+    // Covers the SPIR-V and everything following this header, so that the DXIL is only used with
+    // the SPIR-V it was generated from. The metadata is also validated when it's deserialized.
+    uint64_t Checksum = 0;
+    // Followed by a ProgramBinaryDxilKernel for each kernel, each followed by the
+    // null-terminated kernel name and the serialized DXIL
+};
+struct ProgramBinaryDxilKernel
+{
+    uint32_t NameSize;
+    uint32_t Padding;
+    uint64_t DxilSize;
+};
+
+// The section isn't necessarily aligned, so it's only accessed through copies
+static std::unique_ptr<Program::EmbeddedDxil> ReadEmbeddedDxil(ProgramBinaryHeader const* header, size_t length)
+{
+    auto Ptr = reinterpret_cast<const std::byte*>(header) + header->ComputeFullBlobSize();
+    auto End = reinterpret_cast<const std::byte*>(header) + length;
+
+    ProgramBinaryDxilSection Section;
+    if (header->BinaryType != CL_PROGRAM_BINARY_TYPE_EXECUTABLE || (size_t)(End - Ptr) < sizeof(Section))
+        return nullptr;
+    memcpy(&Section, Ptr, sizeof(Section));
+    Ptr += sizeof(Section);
+    if (Section.SectionGuid != Section.c_ValidSectionGuid ||
+        Section.Checksum != HashBytes(Ptr, End - Ptr, HashBytes(header->GetBinary(), header->BinarySize)))
+        return nullptr;
+
+    auto Embedded = std::make_unique<Program::EmbeddedDxil>();
+    Embedded->CompilerVersion = Section.CompilerVersion;
+    for (uint32_t i = 0; i < Section.NumKernels; ++i)
+    {
+        ProgramBinaryDxilKernel Kernel;
+        if ((size_t)(End - Ptr) < sizeof(Kernel))
+            return nullptr;
+        memcpy(&Kernel, Ptr, sizeof(Kernel));
+        Ptr += sizeof(Kernel);
+        size_t Remaining = End - Ptr;
+        if (Kernel.NameSize == 0 || Remaining < Kernel.NameSize || Remaining - Kernel.NameSize < Kernel.DxilSize ||
+            Ptr[Kernel.NameSize - 1] != std::byte{ 0 })
+            return nullptr;
+
+        std::string Name(reinterpret_cast<const char*>(Ptr));
+        Ptr += Kernel.NameSize;
+        Embedded->Kernels[std::move(Name)].assign(Ptr, Ptr + Kernel.DxilSize);
+        Ptr += Kernel.DxilSize;
+    }
+    return Embedded;
+}
+
 extern CL_API_ENTRY cl_program CL_API_CALL
 clCreateProgramWithSource(cl_context        context_,
     cl_uint           count,
@@ -156,7 +219,8 @@ clCreateProgramWithBinary(cl_context                     context_,
         {
             auto header = reinterpret_cast<ProgramBinaryHeader const*>(binaries[i]);
             unique_spirv BinaryHolder = g_Platform->GetCompiler()->Load(header->GetBinary(), header->BinarySize);
-            NewProgram->StoreBinary(static_cast<Device*>(device_list[i]), std::move(BinaryHolder), header->BinaryType);
+            NewProgram->StoreBinary(static_cast<Device*>(device_list[i]), std::move(BinaryHolder), header->BinaryType,
+                                    ReadEmbeddedDxil(header, lengths[i]));
 
             if (binary_status) *binary_status = CL_SUCCESS;
         }
@@ -435,6 +499,7 @@ clGetProgramInfo(cl_program         program_,
         }
         if (param_value_size)
         {
+            program.FinishDeferredKernels();
             std::lock_guard lock(program.m_Lock);
             size_t *Out = reinterpret_cast<size_t*>(param_value);
             for (cl_uint i = 0; i < program.m_AssociatedDevices.size(); ++i)
@@ -444,7 +509,7 @@ clGetProgramInfo(cl_program         program_,
                 if (BuildData && BuildData->m_BinaryType != CL_PROGRAM_BINARY_TYPE_NONE)
                 {
                     ProgramBinaryHeader header(BuildData->m_OwnedBinary.get(), BuildData->m_BinaryType);
-                    Out[i] = header.ComputeFullBlobSize();
+                    Out[i] = header.ComputeFullBlobSize() + BuildData->GetEmbeddedDxilSection().size();
                 }
             }
         }
@@ -463,6 +528,7 @@ clGetProgramInfo(cl_program         program_,
         }
         if (param_value_size)
         {
+            program.FinishDeferredKernels();
             std::lock_guard lock(program.m_Lock);
             void **Out = reinterpret_cast<void **>(param_value);
             for (cl_uint i = 0; i < program.m_AssociatedDevices.size(); ++i)
@@ -473,7 +539,9 @@ clGetProgramInfo(cl_program         program_,
                 auto& BuildData = program.m_BuildData[program.m_AssociatedDevices[i].first.Get()];
                 if (BuildData && BuildData->m_BinaryType != CL_PROGRAM_BINARY_TYPE_NONE)
                 {
-                    new (Out[i]) ProgramBinaryHeader(BuildData->m_OwnedBinary.get(), BuildData->m_BinaryType, ProgramBinaryHeader::CopyBinaryContentsTag{});
+                    auto header = new (Out[i]) ProgramBinaryHeader(BuildData->m_OwnedBinary.get(), BuildData->m_BinaryType, ProgramBinaryHeader::CopyBinaryContentsTag{});
+                    auto& section = BuildData->GetEmbeddedDxilSection();
+                    memcpy(static_cast<std::byte*>(Out[i]) + header->ComputeFullBlobSize(), section.data(), section.size());
                 }
             }
         }
@@ -659,14 +727,27 @@ cl_int Program::Build(std::vector<D3DDeviceAndRef> Devices, const char* options,
         }
         else
         {
-            // Update build data state, but don't throw away existing ones
+            // Each build gets its own build data, carrying over the binaries. Kernels from a previous
+            // build may still be generating in the background, using the old build data's binary.
+            std::vector<std::pair<std::shared_ptr<PerDeviceData>, std::shared_ptr<PerDeviceData>>> Replaced;
             for (auto& [device, _] : Devices)
             {
                 auto& BuildData = m_BuildData[device.Get()];
                 assert(BuildData && BuildData->m_OwnedBinary);
-                BuildData->m_BuildStatus = CL_BUILD_IN_PROGRESS;
-                BuildData->m_BuildLog.clear();
-                BuildData->m_LastBuildOptions = options ? options : "";
+                auto iter = std::find_if(Replaced.begin(), Replaced.end(), [&](auto const& r) { return r.first == BuildData; });
+                if (iter == Replaced.end())
+                {
+                    auto& Old = *BuildData;
+                    auto New = std::make_shared<PerDeviceData>();
+                    New->m_Device = Old.m_Device;
+                    New->m_D3DDevice = Old.m_D3DDevice;
+                    New->m_OwnedBinary = g_Platform->GetCompiler()->Load(Old.m_OwnedBinary->GetBinary(), Old.m_OwnedBinary->GetBinarySize());
+                    New->m_BinaryType = Old.m_BinaryType;
+                    New->m_EmbeddedDxil = std::move(Old.m_EmbeddedDxil);
+                    New->m_LastBuildOptions = options ? options : "";
+                    iter = Replaced.emplace(Replaced.end(), BuildData, std::move(New));
+                }
+                BuildData = iter->second;
             }
             Args.BinaryBuildDevices = std::move(Devices);
         }
@@ -896,7 +977,7 @@ cl_int Program::Link(const char* options, cl_uint num_input_programs, const cl_p
     }
 }
 
-void Program::StoreBinary(Device *Device, unique_spirv OwnedBinary, cl_program_binary_type Type)
+void Program::StoreBinary(Device *Device, unique_spirv OwnedBinary, cl_program_binary_type Type, std::unique_ptr<EmbeddedDxil> Embedded)
 {
     std::lock_guard Lock(m_Lock);
     auto& BuildData = m_BuildData[Device];
@@ -906,6 +987,7 @@ void Program::StoreBinary(Device *Device, unique_spirv OwnedBinary, cl_program_b
     BuildData->m_OwnedBinary = std::move(OwnedBinary);
     BuildData->m_BinaryType = Type;
     BuildData->m_BuildStatus = CL_BUILD_NONE;
+    BuildData->m_EmbeddedDxil = std::move(Embedded);
 }
 
 const ProgramBinary *Program::GetSpirV(Device* device) const
@@ -1074,6 +1156,165 @@ cl_int Program::ParseOptions(const char* optionsStr, CommonOptions& optionsStruc
     return ValidateAndPushArg();
 }
 
+namespace
+{
+    // Whether Text has an #include that isn't satisfied by one of the embedded headers, and so may be
+    // read from disk. An #include whose target is a macro can't be resolved here, so it counts too.
+    bool MayIncludeFromDisk(std::string_view Text, std::map<std::string, Program::ref_ptr_int> const& Headers)
+    {
+        auto SkipSpaces = [&](size_t Pos)
+        {
+            while (Pos < Text.size() && (Text[Pos] == ' ' || Text[Pos] == '\t'))
+                ++Pos;
+            return Pos;
+        };
+        for (size_t LineStart = 0; LineStart < Text.size();)
+        {
+            size_t LineEnd = Text.find('\n', LineStart);
+            if (LineEnd == std::string_view::npos)
+                LineEnd = Text.size();
+
+            size_t Pos = SkipSpaces(LineStart);
+            if (Pos < LineEnd && Text[Pos] == '#')
+            {
+                Pos = SkipSpaces(Pos + 1);
+                if (Text.substr(Pos, 7) == "include")
+                {
+                    Pos = SkipSpaces(Pos + 7);
+                    char Close = Pos < LineEnd && Text[Pos] == '"' ? '"' : Pos < LineEnd && Text[Pos] == '<' ? '>' : 0;
+                    size_t NameEnd = Close ? Text.find(Close, Pos + 1) : std::string_view::npos;
+                    if (NameEnd == std::string_view::npos || NameEnd > LineEnd ||
+                        Headers.find(std::string(Text.substr(Pos + 1, NameEnd - Pos - 1))) == Headers.end())
+                    {
+                        return true;
+                    }
+                }
+            }
+            LineStart = LineEnd + 1;
+        }
+        return false;
+    }
+
+    // Identifies the SPIR-V produced from OpenCL C across processes, so that building the same
+    // source with the same options loads it from the shader cache instead of running the front end.
+    // The device is implied by which device's cache is used.
+    //
+    // The key covers the source, options and embedded headers, but not files the front end reads from
+    // disk, so programs that may include those aren't cached.
+    struct PersistedSpirvKey
+    {
+        enum class Kind : uint64_t { CompiledObject, Executable, Library };
+        struct
+        {
+            GUID Tag;
+            uint64_t CompilerVersion;
+            Kind BinaryKind;
+        } Header;
+        std::string const& Source;
+        std::string Options;
+        std::string Headers;
+        bool Cacheable = true;
+
+        PersistedSpirvKey(Kind BinaryKind, std::string const& Source, std::vector<std::string> const& Options,
+                          std::map<std::string, Program::ref_ptr_int> const& Headers)
+            : Source(Source)
+        {
+            // {6A0E5C2B-93D4-4F1E-8B7A-2C5F4E9D1A36}
+            static const GUID SpirvTag =
+            { 0x6a0e5c2b, 0x93d4, 0x4f1e, { 0x8b, 0x7a, 0x2c, 0x5f, 0x4e, 0x9d, 0x1a, 0x36 } };
+            Header = { SpirvTag, g_Platform->GetCompiler()->GetVersionForCache(), BinaryKind };
+
+            // Options are already normalized by ParseOptions and AddBuiltinOptions.
+            // Include directories may be given as "-I dir" or "-Idir".
+            for (auto& Option : Options)
+            {
+                Cacheable = Cacheable && Option.compare(0, 2, "-I") != 0;
+                this->Options.append(Option.c_str(), Option.size() + 1);
+            }
+
+            // Headers are included by name, so both names and contents are part of the key
+            Cacheable = Cacheable && !MayIncludeFromDisk(Source, Headers);
+            for (auto& h : Headers)
+            {
+                Cacheable = Cacheable && !MayIncludeFromDisk(h.second->m_Source, Headers);
+                this->Headers.append(h.first.c_str(), h.first.size() + 1);
+                this->Headers.append(h.second->m_Source.c_str(), h.second->m_Source.size() + 1);
+            }
+        }
+
+        // The build log is stored ahead of the SPIR-V, so that a cached build reports the same
+        // warnings as the one that produced it
+        std::unique_ptr<ProgramBinary> Find(ShaderCache& Cache, Logger const& loggers) const
+        {
+            if (!Cacheable || !Cache.HasCache())
+                return nullptr;
+
+            KeyParts Parts(*this);
+            auto Found = Cache.Find(Parts.Keys, Parts.Sizes, _countof(Parts.Keys));
+            uint64_t LogSize = 0;
+            if (!Found.first || Found.second < sizeof(LogSize))
+                return nullptr;
+            memcpy(&LogSize, Found.first.get(), sizeof(LogSize));
+            if (Found.second - sizeof(LogSize) <= LogSize)
+                return nullptr;
+
+            auto pLog = reinterpret_cast<const char*>(Found.first.get() + sizeof(LogSize));
+            auto Binary = g_Platform->GetCompiler()->Load(pLog + LogSize, Found.second - sizeof(LogSize) - LogSize);
+            if (Header.BinaryKind != Kind::CompiledObject && !Binary->Parse(&loggers))
+                return nullptr;
+
+            loggers.Log(std::string(pLog, LogSize).c_str());
+            return Binary;
+        }
+
+        void Store(ShaderCache& Cache, ProgramBinary const& Binary, std::string_view Log) const
+        {
+            if (!Cacheable || !Cache.HasCache())
+                return;
+
+            uint64_t LogSize = Log.size();
+            std::vector<std::byte> Value(sizeof(LogSize) + Log.size() + Binary.GetBinarySize());
+            memcpy(Value.data(), &LogSize, sizeof(LogSize));
+            memcpy(Value.data() + sizeof(LogSize), Log.data(), Log.size());
+            memcpy(Value.data() + sizeof(LogSize) + Log.size(), Binary.GetBinary(), Binary.GetBinarySize());
+            KeyParts Parts(*this);
+            Cache.Store(Parts.Keys, Parts.Sizes, _countof(Parts.Keys), Value.data(), Value.size());
+        }
+
+    private:
+        struct KeyParts
+        {
+            const void* Keys[4];
+            size_t Sizes[4];
+            KeyParts(PersistedSpirvKey const& Key)
+                : Keys{ &Key.Header, Key.Source.data(), Key.Options.data(), Key.Headers.data() }
+                , Sizes{ sizeof(Key.Header), Key.Source.size(), Key.Options.size(), Key.Headers.size() }
+            {
+            }
+        };
+    };
+
+    // What the loggers added to a build log since this was constructed
+    class BuildLogMark
+    {
+        std::recursive_mutex& m_Lock;
+        std::string const& m_Log;
+        size_t m_Start;
+    public:
+        BuildLogMark(std::recursive_mutex& Lock, std::string const& Log)
+            : m_Lock(Lock), m_Log(Log)
+        {
+            std::lock_guard Guard(m_Lock);
+            m_Start = m_Log.size();
+        }
+        std::string Get() const
+        {
+            std::lock_guard Guard(m_Lock);
+            return m_Log.substr(m_Start);
+        }
+    };
+}
+
 cl_int Program::BuildImpl(BuildArgs const& Args)
 {
     cl_int ret = CL_SUCCESS;
@@ -1086,38 +1327,64 @@ cl_int Program::BuildImpl(BuildArgs const& Args)
         Logger loggers(m_Lock, BuildData->m_BuildLog);
         unique_spirv compiledObject;
 
+        unique_spirv linkedObject;
+        Compiler::LinkerArgs link_args = {};
+        link_args.create_library = Args.Common.CreateLibrary;
+
         if (!m_Source.empty())
         {
-            Compiler::CompileArgs args = {};
-            args.program_source = m_Source.c_str();
-            args.cmdline_args.reserve(Args.Common.Args.size());
-            for (auto& def : Args.Common.Args)
+            auto& cache = BuildData->m_D3DDevice->GetShaderCache();
+            PersistedSpirvKey persistedKey(Args.Common.CreateLibrary ? PersistedSpirvKey::Kind::Library : PersistedSpirvKey::Kind::Executable,
+                                           m_Source, Args.Common.Args, {});
+            linkedObject = persistedKey.Find(cache, loggers);
+
+            if (!linkedObject)
             {
-                args.cmdline_args.push_back(def.c_str());
-            }
+                BuildLogMark logMark(m_Lock, BuildData->m_BuildLog);
 
-            compiledObject = pCompiler->Compile(args, loggers);
+                Compiler::CompileArgs args = {};
+                args.program_source = m_Source.c_str();
+                args.cmdline_args.reserve(Args.Common.Args.size());
+                for (auto& def : Args.Common.Args)
+                {
+                    args.cmdline_args.push_back(def.c_str());
+                }
+
+                compiledObject = pCompiler->Compile(args, loggers);
+                if (compiledObject)
+                {
+                    link_args.objs.push_back(compiledObject.get());
+                    linkedObject = pCompiler->Link(link_args, loggers);
+                }
+                if (linkedObject)
+                {
+                    persistedKey.Store(cache, *linkedObject, logMark.Get());
+                }
+            }
         }
         else
         {
             compiledObject = pCompiler->Load(m_IL.data(), m_IL.size());
+            if (compiledObject)
+            {
+                link_args.objs.push_back(compiledObject.get());
+                linkedObject = pCompiler->Link(link_args, loggers);
+            }
         }
 
-        if (compiledObject)
+        PerDeviceData::GenericKernels kernels;
+        if (linkedObject)
         {
-            Compiler::LinkerArgs link_args = {};
-            link_args.create_library = Args.Common.CreateLibrary;
-            link_args.objs.push_back(compiledObject.get());
-            auto linkedObject = pCompiler->Link(link_args, loggers);
-            BuildData->m_OwnedBinary = std::move(linkedObject);
+            kernels = BuildData->GenerateKernels(*linkedObject);
         }
+        BuildData->m_OwnedBinary = std::move(linkedObject);
 
         std::lock_guard Lock(m_Lock);
         if (BuildData->m_OwnedBinary)
         {
             BuildData->m_BinaryType = CL_PROGRAM_BINARY_TYPE_EXECUTABLE;
             BuildData->m_BuildStatus = CL_BUILD_SUCCESS;
-            BuildData->CreateKernels(*this);
+            CreateKernels(BuildData, std::move(kernels));
         }
         else
         {
@@ -1129,23 +1396,48 @@ cl_int Program::BuildImpl(BuildArgs const& Args)
     {
         pCompiler->Initialize(Args.BinaryBuildDevices[0].second->GetShaderCache());
 
-        std::lock_guard Lock(m_Lock);
-        for (auto& [device, _] : Args.BinaryBuildDevices)
+        // The binaries aren't replaced by anything else while this build is in progress
+        std::vector<DeviceLink> links;
         {
-            auto& BuildData = m_BuildData[device.Get()];
-            Logger loggers(m_Lock, BuildData->m_BuildLog);
+            std::lock_guard Lock(m_Lock);
+            for (auto& [device, _] : Args.BinaryBuildDevices)
+            {
+                auto& BuildData = m_BuildData[device.Get()];
+                if (std::none_of(links.begin(), links.end(), [&](DeviceLink const& l) { return l.BuildData == BuildData; }))
+                    links.push_back({ BuildData, { BuildData->m_OwnedBinary.get() } });
+            }
+        }
 
-            Compiler::LinkerArgs link_args = {};
-            link_args.create_library = Args.Common.CreateLibrary;
-            link_args.objs.push_back(BuildData->m_OwnedBinary.get());
-            auto linkedObject = pCompiler->Link(link_args, loggers);
-            BuildData->m_OwnedBinary = std::move(linkedObject);
+        // Binaries that carry DXIL from this compiler are used as-is
+        std::vector<DeviceLink> embedded;
+        for (auto iter = links.begin(); iter != links.end();)
+        {
+            if (UseEmbeddedDxil(*iter))
+            {
+                embedded.push_back(std::move(*iter));
+                iter = links.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
 
+        LinkDevices(links, Args.Common.CreateLibrary);
+        links.insert(links.end(), std::make_move_iterator(embedded.begin()), std::make_move_iterator(embedded.end()));
+
+        std::lock_guard Lock(m_Lock);
+        for (auto& link : links)
+        {
+            auto& BuildData = link.BuildData;
+            BuildData->m_BuildLog += link.Log;
+            BuildData->m_OwnedBinary = std::move(link.Linked);
+            BuildData->m_EmbeddedDxil.reset();
             if (BuildData->m_OwnedBinary)
             {
                 BuildData->m_BinaryType = CL_PROGRAM_BINARY_TYPE_EXECUTABLE;
                 BuildData->m_BuildStatus = CL_BUILD_SUCCESS;
-                BuildData->CreateKernels(*this);
+                CreateKernels(BuildData, std::move(link.Kernels));
             }
             else
             {
@@ -1173,20 +1465,33 @@ cl_int Program::CompileImpl(CompileArgs const& Args)
 
     if (!m_Source.empty())
     {
-        Compiler::CompileArgs args = {};
-        args.cmdline_args.reserve(Args.Common.Args.size());
-        for (auto& def : Args.Common.Args)
-        {
-            args.cmdline_args.push_back(def.c_str());
-        }
-        args.headers.reserve(Args.Headers.size());
-        for (auto& h : Args.Headers)
+        PersistedSpirvKey persistedKey(PersistedSpirvKey::Kind::CompiledObject, m_Source, Args.Common.Args, Args.Headers);
+        auto& cache = BuildData->m_D3DDevice->GetShaderCache();
+        object = persistedKey.Find(cache, loggers);
+
+        if (!object)
         {
-            args.headers.push_back({ h.first.c_str(), h.second->m_Source.c_str() });
-        }
-        args.program_source = m_Source.c_str();
+            BuildLogMark logMark(m_Lock, BuildData->m_BuildLog);
 
-        object = pCompiler->Compile(args, loggers);
+            Compiler::CompileArgs args = {};
+            args.cmdline_args.reserve(Args.Common.Args.size());
+            for (auto& def : Args.Common.Args)
+            {
+                args.cmdline_args.push_back(def.c_str());
+            }
+            args.headers.reserve(Args.Headers.size());
+            for (auto& h : Args.Headers)
+            {
+                args.headers.push_back({ h.first.c_str(), h.second->m_Source.c_str() });
+            }
+            args.program_source = m_Source.c_str();
+
+            object = pCompiler->Compile(args, loggers);
+            if (object)
+            {
+                persistedKey.Store(cache, *object, logMark.Get());
+            }
+        }
     }
     else
     {
@@ -1220,48 +1525,59 @@ cl_int Program::LinkImpl(LinkArgs const& Args)
 {
     cl_int ret = CL_SUCCESS;
     auto pCompiler = g_Platform->GetCompiler();
+    pCompiler->Initialize(m_AssociatedDevices[0].second->GetShaderCache());
 
-    Compiler::LinkerArgs link_args = {};
-    link_args.objs.reserve(Args.LinkPrograms.size());
-    link_args.create_library = Args.Common.CreateLibrary;
-
+    // Devices can share build data, in which case it's only linked once.
+    // The inputs can't be rebuilt while they have pending links, so they can be used without their locks.
+    std::vector<DeviceLink> links;
     for (auto& [Device, D3DDevice] : m_AssociatedDevices)
     {
-        pCompiler->Initialize(D3DDevice->GetShaderCache());
+        std::shared_ptr<PerDeviceData> BuildData;
+        {
+            std::lock_guard Lock(m_Lock);
+            BuildData = m_BuildData[Device.Get()];
+        }
+        if (std::any_of(links.begin(), links.end(), [&](DeviceLink const& l) { return l.BuildData == BuildData; }))
+            continue;
 
-        link_args.objs.clear();
+        DeviceLink link = { BuildData };
+        link.Inputs.reserve(Args.LinkPrograms.size());
         for (cl_uint i = 0; i < Args.LinkPrograms.size(); ++i)
         {
             std::lock_guard Lock(Args.LinkPrograms[i]->m_Lock);
-            auto& BuildData = Args.LinkPrograms[i]->m_BuildData[Device.Get()];
-            if (BuildData)
-                link_args.objs.push_back(BuildData->m_OwnedBinary.get());
+            auto& InputBuildData = Args.LinkPrograms[i]->m_BuildData[Device.Get()];
+            if (InputBuildData)
+                link.Inputs.push_back(InputBuildData->m_OwnedBinary.get());
         }
+        links.push_back(std::move(link));
+    }
+
+    LinkDevices(links, Args.Common.CreateLibrary);
 
+    {
+        std::lock_guard Lock(m_Lock);
+        for (auto& link : links)
         {
-            std::lock_guard Lock(m_Lock);
-            auto& BuildData = m_BuildData[Device.Get()];
-            if (BuildData->m_BuildStatus == CL_BUILD_IN_PROGRESS)
+            auto& BuildData = link.BuildData;
+            BuildData->m_BuildLog += link.Log;
+            if (link.Linked)
             {
-                Logger loggers(m_Lock, BuildData->m_BuildLog);
-                unique_spirv linkedObject = pCompiler->Link(link_args, loggers);
-
-                if (linkedObject)
-                {
-                    BuildData->m_OwnedBinary = std::move(linkedObject);
-                    BuildData->m_BinaryType = Args.Common.CreateLibrary ?
-                        CL_PROGRAM_BINARY_TYPE_LIBRARY : CL_PROGRAM_BINARY_TYPE_EXECUTABLE;
-                    BuildData->m_BuildStatus = CL_BUILD_SUCCESS;
-                    BuildData->CreateKernels(*this);
-                }
-                else
-                {
-                    ret = CL_LINK_PROGRAM_FAILURE;
-                    BuildData->m_BuildStatus = CL_BUILD_ERROR;
-                }
+                BuildData->m_OwnedBinary = std::move(link.Linked);
+                BuildData->m_BinaryType = Args.Common.CreateLibrary ?
+                    CL_PROGRAM_BINARY_TYPE_LIBRARY : CL_PROGRAM_BINARY_TYPE_EXECUTABLE;
+                BuildData->m_BuildStatus = CL_BUILD_SUCCESS;
+                CreateKernels(BuildData, std::move(link.Kernels));
+            }
+            else
+            {
+                ret = CL_LINK_PROGRAM_FAILURE;
+                BuildData->m_BuildStatus = CL_BUILD_ERROR;
             }
         }
+    }
 
+    for (auto& [Device, _] : m_AssociatedDevices)
+    {
         for (cl_uint i = 0; i < Args.LinkPrograms.size(); ++i)
         {
             std::lock_guard Lock(Args.LinkPrograms[i]->m_Lock);
@@ -1277,22 +1593,279 @@ cl_int Program::LinkImpl(LinkArgs const& Args)
     return ret;
 }
 
-void Program::PerDeviceData::CreateKernels(Program& program)
+static bool SameLinkInputs(std::vector<ProgramBinary const*> const& a, std::vector<ProgramBinary const*> const& b)
 {
-    if (m_BinaryType != CL_PROGRAM_BINARY_TYPE_EXECUTABLE)
-        return;
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](ProgramBinary const* x, ProgramBinary const* y)
+    {
+        return x == y ||
+            (x->GetBinarySize() == y->GetBinarySize() &&
+             memcmp(x->GetBinary(), y->GetBinary(), x->GetBinarySize()) == 0);
+    });
+}
+
+void Program::LinkDevices(std::vector<DeviceLink>& links, bool createLibrary)
+{
+    auto pCompiler = g_Platform->GetCompiler();
+
+    // Linking SPIR-V doesn't depend on the device, so devices with identical inputs are only linked
+    // once, by the first of them
+    std::vector<size_t> leaders(links.size());
+    std::vector<size_t> uniqueLinks;
+    for (size_t i = 0; i < links.size(); ++i)
+    {
+        auto same = std::find_if(uniqueLinks.begin(), uniqueLinks.end(),
+                                 [&](size_t j) { return SameLinkInputs(links[i].Inputs, links[j].Inputs); });
+        leaders[i] = same == uniqueLinks.end() ? i : *same;
+        if (leaders[i] == i)
+            uniqueLinks.push_back(i);
+    }
+
+    g_Platform->ParallelProgramOp(uniqueLinks.size(), [&](size_t u)
+    {
+        auto& link = links[uniqueLinks[u]];
+        std::recursive_mutex logLock;
+        Logger loggers(logLock, link.Log);
 
+        Compiler::LinkerArgs link_args = {};
+        link_args.create_library = createLibrary;
+        link_args.objs = link.Inputs;
+        link.Linked = pCompiler->Link(link_args, loggers);
+    });
+
+    // Each device still needs its own copy of the binary, since its DXIL references it
+    g_Platform->ParallelProgramOp(links.size(), [&](size_t i)
+    {
+        auto& link = links[i];
+        auto& leader = links[leaders[i]];
+        if (&link != &leader)
+        {
+            link.Log = leader.Log;
+            if (leader.Linked)
+            {
+                std::recursive_mutex logLock;
+                Logger loggers(logLock, link.Log);
+                link.Linked = pCompiler->Load(leader.Linked->GetBinary(), leader.Linked->GetBinarySize());
+                if (!link.Linked->Parse(&loggers))
+                    link.Linked.reset();
+            }
+        }
+        if (link.Linked && !createLibrary)
+        {
+            link.Kernels = link.BuildData->GenerateKernels(*link.Linked);
+        }
+    });
+}
+
+bool Program::UseEmbeddedDxil(DeviceLink& link)
+{
+    auto& BuildData = *link.BuildData;
+    auto pCompiler = g_Platform->GetCompiler();
+    if (!BuildData.m_EmbeddedDxil || BuildData.m_EmbeddedDxil->CompilerVersion != pCompiler->GetVersionForCache())
+        return false;
+
+    std::string log;
+    std::recursive_mutex logLock;
+    Logger loggers(logLock, log);
+    auto binary = pCompiler->Load(BuildData.m_OwnedBinary->GetBinary(), BuildData.m_OwnedBinary->GetBinarySize());
+    if (!binary->Parse(&loggers))
+        return false;
+
+    PerDeviceData::GenericKernels kernels;
+    for (auto& kernelMeta : binary->GetKernelInfo())
+    {
+        auto iter = BuildData.m_EmbeddedDxil->Kernels.find(kernelMeta.name);
+        if (iter == BuildData.m_EmbeddedDxil->Kernels.end())
+            return false;
+        auto dxil = CompiledDxil::DeserializeGeneric(*binary, kernelMeta.name, iter->second.data(), iter->second.size());
+        if (!dxil)
+            return false;
+        kernels.m_Dxil.emplace_back(kernelMeta.name, std::move(dxil));
+    }
+
+    log += "Using the DXIL embedded in the program binary.\n";
+    link.Linked = std::move(binary);
+    link.Kernels = std::move(kernels);
+    link.Log = std::move(log);
+    return true;
+}
+
+std::vector<std::byte> const& Program::PerDeviceData::GetEmbeddedDxilSection()
+{
+    if (m_EmbeddedDxilSection)
+        return *m_EmbeddedDxilSection;
+
+    // Only kept once it's complete, in case serializing throws
+    std::vector<std::byte> Data;
+    // Deferred kernels may still be generating, and this is called with the program lock held
+    auto IsAvailable = [](auto const& pair)
+    {
+        auto& kernel = pair.second;
+        return (!kernel.m_GenerateOnce || kernel.m_Generated.load(std::memory_order_acquire)) && kernel.m_GenericDxil;
+    };
+    if (m_BinaryType != CL_PROGRAM_BINARY_TYPE_EXECUTABLE ||
+        !std::all_of(m_Kernels.begin(), m_Kernels.end(), IsAvailable))
+        return m_EmbeddedDxilSection.emplace();
+
+    ProgramBinaryDxilSection Section;
+    Section.CompilerVersion = g_Platform->GetCompiler()->GetVersionForCache();
+    Section.NumKernels = (uint32_t)m_Kernels.size();
+    auto Append = [&Data](const void* p, size_t size)
+    {
+        auto bytes = static_cast<const std::byte*>(p);
+        Data.insert(Data.end(), bytes, bytes + size);
+    };
+    Append(&Section, sizeof(Section));
+    for (auto& [name, kernel] : m_Kernels)
+    {
+        auto Dxil = kernel.m_GenericDxil->SerializeGeneric();
+        ProgramBinaryDxilKernel Kernel = { (uint32_t)name.size() + 1, 0, Dxil.size() };
+        Append(&Kernel, sizeof(Kernel));
+        Append(name.c_str(), name.size() + 1);
+        Append(Dxil.data(), Dxil.size());
+    }
+
+    Section.Checksum = HashBytes(Data.data() + sizeof(Section), Data.size() - sizeof(Section),
+                                 HashBytes(m_OwnedBinary->GetBinary(), m_OwnedBinary->GetBinarySize()));
+    memcpy(Data.data(), &Section, sizeof(Section));
+    return m_EmbeddedDxilSection.emplace(std::move(Data));
+}
+
+void Program::FinishDeferredKernels() noexcept
+{
+    try
+    {
+        // Kernels are only added to build data before it's published, and the build data is kept
+        // alive here, so the kernels can be used without the lock like clCreateKernel does
+        std::vector<std::tuple<std::shared_ptr<PerDeviceData>, std::string const*, KernelData*>> Deferred;
+        {
+            std::lock_guard Lock(m_Lock);
+            for (auto& pair : m_BuildData)
+            {
+                auto& BuildData = pair.second;
+                if (!BuildData || BuildData->m_EmbeddedDxilSection ||
+                    std::any_of(Deferred.begin(), Deferred.end(), [&](auto const& d) { return std::get<0>(d) == BuildData; }))
+                    continue;
+                for (auto& [name, kernel] : BuildData->m_Kernels)
+                {
+                    if (kernel.m_GenerateOnce && !kernel.m_Generated.load(std::memory_order_acquire))
+                        Deferred.emplace_back(BuildData, &name, &kernel);
+                }
+            }
+        }
+        for (auto& [BuildData, name, kernel] : Deferred)
+        {
+            (void)GetGenericDxil(*BuildData, *name, *kernel);
+        }
+    }
+    catch (...) {} // The binaries just don't carry the DXIL
+}
+
+static bool UseLazyKernels()
+{
+    static const bool s_Lazy = []()
+    {
+        bool lazy = false;
+        char *lazyStr = nullptr;
+        if (_dupenv_s(&lazyStr, nullptr, "CLON12_LAZY_KERNELS") == 0 && lazyStr)
+        {
+            lazy = strcmp(lazyStr, "0") != 0;
+        }
+        free(lazyStr);
+        return lazy;
+    }();
+    return s_Lazy;
+}
+
+static unique_dxil GenerateGenericDxil(ProgramBinary const& binary, const char* name, Logger const& loggers)
+{
+    auto dxil = g_Platform->GetCompiler()->GetKernel(name, binary, nullptr /*configuration*/, &loggers);
+    if (dxil)
+        dxil->Sign();
+    return dxil;
+}
+
+Program::PerDeviceData::GenericKernels Program::PerDeviceData::GenerateKernels(ProgramBinary const& binary) const
+{
     auto pCompiler = g_Platform->GetCompiler();
     pCompiler->Initialize(m_D3DDevice->GetShaderCache());
 
-    auto& kernels = m_OwnedBinary->GetKernelInfo();
-    Logger loggers(program.m_Lock, m_BuildLog);
-    for (auto& kernelMeta : kernels)
+    GenericKernels result;
+
+    auto& kernels = binary.GetKernelInfo();
+    result.m_Dxil.resize(kernels.size());
+    result.m_Logs.resize(kernels.size());
+    if (UseLazyKernels())
     {
-        auto name = kernelMeta.name;
-        auto& kernel = m_Kernels.emplace(name, unique_dxil{}).first->second;
-        kernel.m_GenericDxil = pCompiler->GetKernel(name, *m_OwnedBinary, nullptr /*configuration*/, &loggers);
-        if (kernel.m_GenericDxil)
-            kernel.m_GenericDxil->Sign();
+        result.m_Deferred = true;
+        for (size_t i = 0; i < kernels.size(); ++i)
+        {
+            result.m_Dxil[i].first = kernels[i].name;
+        }
+        return result;
     }
+
+    g_Platform->ParallelProgramOp(kernels.size(), [&](size_t i)
+    {
+        // Kernels log into their own strings, so they never wait on the program lock
+        std::recursive_mutex logLock;
+        Logger loggers(logLock, result.m_Logs[i]);
+
+        auto name = kernels[i].name;
+        result.m_Dxil[i] = { name, GenerateGenericDxil(binary, name, loggers) };
+    });
+    return result;
 }
+
+void Program::CreateKernels(std::shared_ptr<PerDeviceData> const& buildData, PerDeviceData::GenericKernels kernels)
+{
+    if (buildData->m_BinaryType != CL_PROGRAM_BINARY_TYPE_EXECUTABLE)
+        return;
+
+    for (auto& log : kernels.m_Logs)
+    {
+        buildData->m_BuildLog += log;
+    }
+    for (auto& [name, dxil] : kernels.m_Dxil)
+    {
+        auto& kernel = buildData->m_Kernels.emplace(name, unique_dxil{}).first->second;
+        kernel.m_GenericDxil = std::move(dxil);
+        kernel.m_GenerateOnce.reset(kernels.m_Deferred ? new std::once_flag : nullptr);
+    }
+
+    if (!kernels.m_Deferred)
+        return;
+
+    for (auto& [name, _] : kernels.m_Dxil)
+    {
+        g_Platform->QueueBackgroundProgramOp([this, selfRef = ref_ptr_int(this), buildData, name = name]()
+        {
+            KernelData* kernel = nullptr;
+            {
+                std::lock_guard Lock(m_Lock);
+                if (auto iter = buildData->m_Kernels.find(name); iter != buildData->m_Kernels.end())
+                    kernel = &iter->second;
+            }
+            try
+            {
+                if (kernel)
+                    (void)GetGenericDxil(*buildData, name, *kernel);
+            }
+            catch (...) {} // Whoever creates the kernel will try again, and can report the error
+        });
+    }
+}
+
+CompiledDxil const* Program::GetGenericDxil(PerDeviceData& buildData, std::string const& name, KernelData& kernel)
+{
+    if (kernel.m_GenerateOnce)
+    {
+        std::call_once(*kernel.m_GenerateOnce, [&]()
+        {
+            Logger loggers(m_Lock, buildData.m_BuildLog);
+            kernel.m_GenericDxil = GenerateGenericDxil(*buildData.m_OwnedBinary, name.c_str(), loggers);
+            kernel.m_Generated.store(true, std::memory_order_release);
+        });
+    }
+    return kernel.m_GenericDxil.get();
+}
+
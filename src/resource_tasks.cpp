@@ -1399,14 +1399,42 @@ private:
         }
     }
 
+    bool IsBufferCopy() const
+    {
+        return m_Source->m_Desc.image_type == CL_MEM_OBJECT_BUFFER &&
+            m_Dest->m_Desc.image_type == CL_MEM_OBJECT_BUFFER;
+    }
+
     void MigrateResources() final
     {
         m_Source->EnqueueMigrateResource(&m_CommandQueue->GetD3DDevice(), this, 0);
         m_Dest->EnqueueMigrateResource(&m_CommandQueue->GetD3DDevice(), this, 0);
     }
+    bool GetResourceUsage(std::vector<ResourceUsage>& Usage) final
+    {
+        // Image copies may go through a temporary resource
+        if (!IsBufferCopy())
+            return false;
+
+        auto& Device = m_CommandQueue->GetD3DDevice();
+        Usage.push_back({ m_Source->GetUnderlyingResource(&Device), D3D12_RESOURCE_STATE_COPY_SOURCE, false });
+        Usage.push_back({ m_Dest->GetUnderlyingResource(&Device), D3D12_RESOURCE_STATE_COPY_DEST, true });
+        return true;
+    }
     void RecordImpl() final
     {
         auto& ImmCtx = m_CommandQueue->GetD3DDevice().ImmCtx();
+        // Buffers imported from GL wrap the other API's D3D12 resource, which may be placed
+        if (IsBufferCopy() &&
+            !m_Source->m_CreationArgs.m_PrivateCreateFn && !m_Dest->m_CreationArgs.m_PrivateCreateFn &&
+            m_CommandQueue->GetD3DDevice().GetCopyEngine().CopyBufferRegion(
+                ImmCtx,
+                m_Dest->GetActiveUnderlyingResource(), m_Args.DstX,
+                m_Source->GetActiveUnderlyingResource(), m_Args.SrcX,
+                m_Args.Width))
+        {
+            return;
+        }
         if (ImageTypesCopyCompatible(m_Source->m_Desc.image_type, m_Dest->m_Desc.image_type))
         {
             for (cl_ushort i = 0; i < m_Args.NumArraySlices; ++i)
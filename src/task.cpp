@@ -2,6 +2,7 @@
 // Licensed under the MIT License.
 #include "task.hpp"
 #include "queue.hpp"
+#include "printf.hpp"
 
 /* Event Object APIs */
 extern CL_API_ENTRY cl_int CL_API_CALL
@@ -531,6 +532,9 @@ void Task::AddDependencies(const cl_event* event_wait_list, cl_uint num_events_i
 cl_int Task::WaitForCompletion()
 {
     m_CompletionFuture.wait();
+    // Printf output from completed kernels is written asynchronously, make sure this task's is
+    // visible before returning
+    g_Platform->GetPrintfOutput().WaitFor(m_PrintfPosition);
     return (cl_int)m_State;
 }
 
@@ -564,6 +568,10 @@ void Task::RegisterCallback(cl_int command_exec_callback_type, NotificationReque
     }
     if (bCallNotification)
     {
+        if (StateToSend <= CL_COMPLETE)
+        {
+            g_Platform->GetPrintfOutput().WaitFor(m_PrintfPosition);
+        }
         pfn_notify(this, StateToSend, user_data);
     }
 }
@@ -647,6 +655,8 @@ void Task::Complete(cl_int error, TaskPoolLock const& lock)
         OnComplete();
     }
 
+    // Includes any output OnComplete queued, and is needed by the completion callbacks
+    m_PrintfPosition = g_Platform->GetPrintfOutput().GetQueuedPosition();
     FireNotifications();
 
     if (error < 0)
@@ -689,8 +699,14 @@ void Task::Complete(cl_int error, TaskPoolLock const& lock)
 
 void Task::FireNotification(NotificationRequest const& callback, cl_int state)
 {
+    // Completion callbacks see the task's printf output already written, like waiting on it would
+    uint64_t PrintfPosition = state <= CL_COMPLETE ? m_PrintfPosition : 0;
     g_Platform->QueueCallback([=]()
     {
+        if (PrintfPosition)
+        {
+            g_Platform->GetPrintfOutput().WaitFor(PrintfPosition);
+        }
         callback.m_pfn(this, state, callback.m_userData);
     });
 }
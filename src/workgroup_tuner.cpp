@@ -0,0 +1,242 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#include "workgroup_tuner.hpp"
+#include "cache.hpp"
+
+#include <numeric>
+
+uint16_t WorkGroupSizing::LargestDivisorAtMost(size_t Value, uint16_t Limit)
+{
+    for (uint16_t Divisor = std::max<uint16_t>(Limit, 1); Divisor > 1; --Divisor)
+    {
+        if (Value % Divisor == 0)
+            return Divisor;
+    }
+    return 1;
+}
+
+void WorkGroupSizing::FitToMaxThreads(std::array<uint16_t, 3>& LocalSizes, cl_uint work_dim, size_t const* global_work_size)
+{
+    while ((uint64_t)LocalSizes[0] * (uint64_t)LocalSizes[1] * (uint64_t)LocalSizes[2] > D3D12_CS_THREAD_GROUP_MAX_THREADS_PER_GROUP)
+    {
+        cl_uint Largest = 0;
+        for (cl_uint i = 1; i < work_dim; ++i)
+        {
+            if (LocalSizes[i] > LocalSizes[Largest])
+                Largest = i;
+        }
+        assert(LocalSizes[Largest] > 1);
+        LocalSizes[Largest] = LargestDivisorAtMost(global_work_size[Largest], LocalSizes[Largest] - 1);
+    }
+}
+
+std::array<uint16_t, 3> WorkGroupSizing::HeuristicLocalSize(cl_uint work_dim, uint32_t WaveWidth, size_t LocalMemSize)
+{
+    // 64 threads has historically been a good default across vendors. Never go below a full wave.
+    uint32_t TargetThreads = std::max<uint32_t>(64, WaveWidth);
+    // Local memory limits how many groups can be resident at once, so use it with more threads.
+    if (LocalMemSize >= 16 * 1024)
+        TargetThreads = std::max<uint32_t>(TargetThreads, 256);
+    else if (LocalMemSize >= 4 * 1024)
+        TargetThreads = std::max<uint32_t>(TargetThreads, 128);
+    TargetThreads = std::min<uint32_t>(TargetThreads, D3D12_CS_THREAD_GROUP_MAX_THREADS_PER_GROUP);
+
+    uint32_t Log2Threads = 0;
+    while ((2u << Log2Threads) <= TargetThreads)
+        ++Log2Threads;
+
+    // Spread the threads as evenly as possible over the dimensions, favoring X.
+    // This gives {64,1,1}, {8,8,1}, and {4,4,4} for the default thread count.
+    std::array<uint16_t, 3> LocalSizes = { 1, 1, 1 };
+    for (cl_uint i = 0; i < work_dim; ++i)
+    {
+        uint32_t Log2Size = Log2Threads / work_dim + (i < Log2Threads % work_dim ? 1 : 0);
+        LocalSizes[i] = (uint16_t)(1u << Log2Size);
+    }
+    return LocalSizes;
+}
+
+bool WorkGroupTuner::IsEnabled()
+{
+    static const bool s_Enabled = []()
+    {
+        char *autotuneStr = nullptr;
+        bool enabled = _dupenv_s(&autotuneStr, nullptr, "CLON12_WORKGROUP_AUTOTUNE") == 0 &&
+            autotuneStr &&
+            strcmp(autotuneStr, "1") == 0;
+        free(autotuneStr);
+        return enabled;
+    }();
+    return s_Enabled;
+}
+
+// Global sizes are bucketed by power of two, so a kernel that's dispatched with a slightly
+// different size each frame still benefits from tuning.
+static std::array<uint8_t, 3> GetSizeClass(cl_uint work_dim, size_t const* global_work_size)
+{
+    std::array<uint8_t, 3> SizeClass = {};
+    for (cl_uint i = 0; i < work_dim; ++i)
+    {
+        uint8_t Log2 = 0;
+        while (Log2 < 63 && ((size_t)1 << Log2) < global_work_size[i])
+            ++Log2;
+        SizeClass[i] = Log2;
+    }
+    return SizeClass;
+}
+
+static bool IsValidForDispatch(std::array<uint16_t, 3> const& LocalSizes, cl_uint work_dim, size_t const* global_work_size)
+{
+    for (cl_uint i = 0; i < work_dim; ++i)
+    {
+        if (global_work_size[i] % LocalSizes[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+struct PersistedKeyHeader
+{
+    char Magic[8];
+    uint64_t BinaryHash;
+    uint32_t WorkDim;
+    std::array<uint8_t, 3> SizeClass;
+    uint8_t Padding;
+};
+
+auto WorkGroupTuner::GetEntry(uint64_t Key, KernelIdentity const& Kernel, cl_uint work_dim, std::array<uint8_t, 3> const& SizeClass,
+                              size_t const* global_work_size, std::array<uint16_t, 3> const& Heuristic) -> Entry&
+{
+    if (auto iter = m_Entries.find(Key); iter != m_Entries.end())
+        return iter->second;
+
+    Entry NewEntry;
+
+    PersistedKeyHeader Header = { { 'C', 'L', 'O', 'N', '1', '2', 'W', 'G' }, Kernel.BinaryHash, work_dim, SizeClass, 0 };
+    NewEntry.CacheKey.resize(sizeof(Header) + Kernel.Name.size());
+    memcpy(NewEntry.CacheKey.data(), &Header, sizeof(Header));
+    memcpy(NewEntry.CacheKey.data() + sizeof(Header), Kernel.Name.data(), Kernel.Name.size());
+
+    if (auto Found = m_Cache.Find(NewEntry.CacheKey.data(), NewEntry.CacheKey.size());
+        Found.first && Found.second == sizeof(NewEntry.Result))
+    {
+        memcpy(NewEntry.Result.data(), Found.first.get(), sizeof(NewEntry.Result));
+        NewEntry.Tuned = true;
+    }
+    else
+    {
+        // Candidates are a range of group sizes around the heuristic's, shaped for this dispatch
+        NewEntry.Candidates.push_back({ Heuristic });
+        for (uint32_t Threads = 64; Threads <= D3D12_CS_THREAD_GROUP_MAX_THREADS_PER_GROUP; Threads *= 2)
+        {
+            auto LocalSizes = WorkGroupSizing::HeuristicLocalSize(work_dim, Threads, 0);
+            for (cl_uint i = 0; i < work_dim; ++i)
+            {
+                LocalSizes[i] = WorkGroupSizing::LargestDivisorAtMost(global_work_size[i], LocalSizes[i]);
+            }
+            if (std::none_of(NewEntry.Candidates.begin(), NewEntry.Candidates.end(),
+                             [&LocalSizes](Candidate const& c) { return c.LocalSizes == LocalSizes; }))
+            {
+                NewEntry.Candidates.push_back({ LocalSizes });
+            }
+        }
+    }
+
+    return m_Entries.emplace(Key, std::move(NewEntry)).first->second;
+}
+
+bool WorkGroupTuner::Choose(KernelIdentity const& Kernel, cl_uint work_dim, size_t const* global_work_size,
+                            std::array<uint16_t, 3>& LocalSizes, Sample& SampleOut)
+{
+    auto SizeClass = GetSizeClass(work_dim, global_work_size);
+    size_t Key = Kernel.BinaryHash;
+    D3D12TranslationLayer::hash_combine(Key, std::hash<std::string>()(Kernel.Name));
+    D3D12TranslationLayer::hash_combine(Key, work_dim);
+    for (auto c : SizeClass)
+        D3D12TranslationLayer::hash_combine(Key, c);
+
+    std::lock_guard Lock(m_Lock);
+    Entry& entry = GetEntry(Key, Kernel, work_dim, SizeClass, global_work_size, LocalSizes);
+
+    if (!entry.Tuned && ++entry.NumDispatches > entry.Candidates.size() * MaxDispatchesPerCandidate)
+    {
+        Finish(entry);
+    }
+
+    std::array<uint16_t, 3> const* Choice = nullptr;
+    if (entry.Tuned)
+    {
+        Choice = &entry.Result;
+    }
+    else
+    {
+        // Hand out the valid candidate with the fewest samples, so that one that doesn't fit this
+        // dispatch is skipped rather than holding up the others
+        Candidate* Next = nullptr;
+        for (auto& c : entry.Candidates)
+        {
+            if (c.NumOutstanding && entry.NumDispatches - c.LastHandedOut > SampleTimeout)
+                c.NumOutstanding = 0;
+            uint32_t NumSamples = c.NumReported + c.NumOutstanding;
+            if (NumSamples < SamplesPerCandidate && IsValidForDispatch(c.LocalSizes, work_dim, global_work_size) &&
+                (!Next || NumSamples < Next->NumReported + Next->NumOutstanding))
+            {
+                Next = &c;
+            }
+        }
+        if (Next)
+        {
+            ++Next->NumOutstanding;
+            Next->LastHandedOut = entry.NumDispatches;
+            SampleOut.EntryKey = Key;
+            SampleOut.Candidate = (uint32_t)std::distance(entry.Candidates.data(), Next);
+            SampleOut.NumWorkItems = std::accumulate(global_work_size, global_work_size + work_dim, (uint64_t)1, std::multiplies<uint64_t>());
+            Choice = &Next->LocalSizes;
+        }
+    }
+
+    // Sizes in the same class may not share divisors, in which case stick with the heuristic
+    if (!Choice || !IsValidForDispatch(*Choice, work_dim, global_work_size))
+        return false;
+
+    LocalSizes = *Choice;
+    return true;
+}
+
+void WorkGroupTuner::ReportSample(Sample const& Sample, uint64_t Nanoseconds) noexcept
+{
+    std::lock_guard Lock(m_Lock);
+    auto iter = m_Entries.find(Sample.EntryKey);
+    if (iter == m_Entries.end() || iter->second.Tuned)
+        return;
+
+    Entry& entry = iter->second;
+    Candidate& c = entry.Candidates[Sample.Candidate];
+    uint64_t TimePerItem = Nanoseconds * 1000 / std::max<uint64_t>(Sample.NumWorkItems, 1);
+    c.BestTime = std::min(c.BestTime, TimePerItem);
+    ++c.NumReported;
+    // A sample that was assumed lost may still show up
+    if (c.NumOutstanding)
+        --c.NumOutstanding;
+
+    if (std::all_of(entry.Candidates.begin(), entry.Candidates.end(),
+                    [](Candidate const& other) { return other.NumReported >= SamplesPerCandidate; }))
+    {
+        Finish(entry);
+    }
+}
+
+void WorkGroupTuner::Finish(Entry& entry) noexcept
+{
+    auto Best = std::min_element(entry.Candidates.begin(), entry.Candidates.end(),
+                                 [](Candidate const& a, Candidate const& b) { return a.BestTime < b.BestTime; });
+    bool Measured = Best->BestTime != UINT64_MAX;
+    // Without any measurements, there's nothing worth persisting
+    entry.Result = Measured ? Best->LocalSizes : entry.Candidates[0].LocalSizes;
+    entry.Tuned = true;
+    entry.Candidates.clear();
+    entry.Candidates.shrink_to_fit();
+
+    if (Measured)
+        m_Cache.Store(entry.CacheKey.data(), entry.CacheKey.size(), entry.Result.data(), sizeof(entry.Result));
+}
@@ -0,0 +1,169 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+#include "gtest/gtest.h"
+
+#include "file_cache.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+class FileCacheTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        m_Directory = (std::filesystem::temp_directory_path() / "openclon12_filecachetest" /
+                       ::testing::UnitTest::GetInstance()->current_test_info()->name()).string();
+        std::error_code ec;
+        std::filesystem::remove_all(m_Directory, ec);
+    }
+    void TearDown() override
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(m_Directory, ec);
+    }
+
+    std::shared_ptr<FileCache> Open(uint64_t Version = 1, uint64_t MaxSize = 1 << 20)
+    {
+        return FileCache::Open(m_Directory, "cache.bin", Version, MaxSize);
+    }
+    uint64_t FileSize() const
+    {
+        return std::filesystem::file_size(std::filesystem::path(m_Directory) / "cache.bin");
+    }
+
+    static void Store(FileCache& Cache, std::string const& Key, std::string const& Value)
+    {
+        Cache.Store(Key, Value.data(), Value.size());
+    }
+    static std::string Find(FileCache& Cache, std::string const& Key)
+    {
+        auto Found = Cache.Find(Key);
+        if (!Found.first)
+            return "<missing>";
+        return std::string(reinterpret_cast<const char*>(Found.first.get()), Found.second);
+    }
+
+    std::string m_Directory;
+};
+
+TEST_F(FileCacheTest, Append)
+{
+    auto Cache = Open();
+    ASSERT_TRUE(Cache);
+    EXPECT_EQ(Find(*Cache, "a"), "<missing>");
+
+    Store(*Cache, "a", "first");
+    Store(*Cache, "b", std::string(1000, 'b'));
+    Store(*Cache, "a", "second");
+    EXPECT_EQ(Find(*Cache, "a"), "second");
+    EXPECT_EQ(Find(*Cache, "b"), std::string(1000, 'b'));
+
+    // Opening the same file again within the process shares the cache
+    EXPECT_EQ(Open(), Cache);
+}
+
+TEST_F(FileCacheTest, Reopen)
+{
+    {
+        auto Cache = Open();
+        ASSERT_TRUE(Cache);
+        Store(*Cache, "a", "first");
+        Store(*Cache, "b", "value");
+        Store(*Cache, "a", "second");
+        Store(*Cache, "empty", "");
+    }
+
+    auto Cache = Open();
+    ASSERT_TRUE(Cache);
+    EXPECT_EQ(Find(*Cache, "a"), "second");
+    EXPECT_EQ(Find(*Cache, "b"), "value");
+    EXPECT_EQ(Find(*Cache, "empty"), "");
+}
+
+TEST_F(FileCacheTest, TornTail)
+{
+    uint64_t CompleteSize = 0;
+    {
+        auto Cache = Open();
+        ASSERT_TRUE(Cache);
+        Store(*Cache, "a", "complete");
+        CompleteSize = FileSize();
+        Store(*Cache, "b", std::string(100, 'b'));
+    }
+
+    // The last entry was cut short while it was being written
+    std::filesystem::resize_file(std::filesystem::path(m_Directory) / "cache.bin", FileSize() - 10);
+    {
+        auto Cache = Open();
+        ASSERT_TRUE(Cache);
+        EXPECT_EQ(Find(*Cache, "a"), "complete");
+        EXPECT_EQ(Find(*Cache, "b"), "<missing>");
+        EXPECT_EQ(FileSize(), CompleteSize);
+        Store(*Cache, "c", "after");
+    }
+
+    // Garbage after the last entry is dropped the same way
+    {
+        std::ofstream File(std::filesystem::path(m_Directory) / "cache.bin", std::ios::binary | std::ios::app);
+        File << "not an entry, just some garbage";
+    }
+    auto Cache = Open();
+    ASSERT_TRUE(Cache);
+    EXPECT_EQ(Find(*Cache, "a"), "complete");
+    EXPECT_EQ(Find(*Cache, "c"), "after");
+}
+
+TEST_F(FileCacheTest, VersionChange)
+{
+    {
+        auto Cache = Open(1);
+        ASSERT_TRUE(Cache);
+        Store(*Cache, "a", "old");
+
+        // A cache for the same file with another version can't be open at the same time
+        EXPECT_FALSE(Open(2));
+    }
+
+    {
+        auto Cache = Open(2);
+        ASSERT_TRUE(Cache);
+        EXPECT_EQ(Find(*Cache, "a"), "<missing>");
+        Store(*Cache, "a", "new");
+    }
+
+    auto Cache = Open(1);
+    ASSERT_TRUE(Cache);
+    EXPECT_EQ(Find(*Cache, "a"), "<missing>");
+}
+
+TEST_F(FileCacheTest, Compaction)
+{
+    constexpr uint64_t MaxSize = 4096;
+    std::string const Value(100, 'v');
+    {
+        auto Cache = Open(1, MaxSize);
+        ASSERT_TRUE(Cache);
+        Store(*Cache, "kept", Value);
+        for (int i = 0; i < 100; ++i)
+        {
+            Store(*Cache, "key" + std::to_string(i), Value);
+            // Recently used entries survive compaction
+            EXPECT_EQ(Find(*Cache, "kept"), Value);
+            EXPECT_LE(FileSize(), MaxSize);
+        }
+        EXPECT_EQ(Find(*Cache, "key0"), "<missing>");
+        EXPECT_EQ(Find(*Cache, "key99"), Value);
+
+        // Values too large for the file at all aren't stored
+        Store(*Cache, "huge", std::string(MaxSize, 'h'));
+        EXPECT_EQ(Find(*Cache, "huge"), "<missing>");
+    }
+
+    auto Cache = Open(1, MaxSize);
+    ASSERT_TRUE(Cache);
+    EXPECT_EQ(Find(*Cache, "kept"), Value);
+    EXPECT_EQ(Find(*Cache, "key99"), Value);
+    EXPECT_EQ(Find(*Cache, "key0"), "<missing>");
+}
@@ -4,6 +4,7 @@
 
 #define CL_TARGET_OPENCL_VERSION 220
 #include <CL/cl.h>
+#include <CL/cl_ext.h>
 
 #define CL_HPP_ENABLE_EXCEPTIONS
 #define CL_HPP_TARGET_OPENCL_VERSION 220
@@ -14,6 +15,8 @@
 #include <utility>
 #include <algorithm>
 #include <numeric>
+#include <chrono>
+#include <string>
 
 #include <d3d12.h>
 
@@ -211,6 +214,48 @@ TEST(OpenCLOn12, Printf)
     queue.finish();
 }
 
+static void CL_CALLBACK AppendPrintfOutput(const char* buffer, size_t len, size_t complete, void* user_data)
+{
+    EXPECT_EQ(complete, 1u);
+    static_cast<std::string*>(user_data)->append(buffer, len);
+}
+
+TEST(OpenCLOn12, PrintfCallback)
+{
+    auto&& [warpContext, device] = GetWARPContext();
+
+    std::string output;
+    cl_context_properties context_props[] =
+    {
+        CL_CONTEXT_PLATFORM, (cl_context_properties)device.getInfo<CL_DEVICE_PLATFORM>(),
+        CL_PRINTF_CALLBACK_ARM, (cl_context_properties)AppendPrintfOutput,
+        0
+    };
+    cl_device_id rawDevice = device();
+    cl_int error = CL_SUCCESS;
+    cl::Context context(clCreateContext(context_props, 1, &rawDevice,
+        [](const char* msg, const void*, size_t, void*)
+    {
+        ADD_FAILURE() << msg;
+    }, &output, &error));
+    ASSERT_EQ(error, CL_SUCCESS);
+    cl::CommandQueue queue(context, device);
+
+    const char* kernel_source =
+    R"(
+    kernel void test_printf() {
+        printf("%d%% %s %v2hhx\n", 15, "done", (uchar2)(10, 11));
+    })";
+
+    cl::Program program(context, kernel_source, true /*build*/);
+    cl::Kernel kernel(program, "test_printf");
+
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(1));
+    queue.finish();
+
+    EXPECT_EQ(output, "15% done a,b\n");
+}
+
 TEST(OpenCLOn12, RecursiveFlush)
 {
     auto&& [context, device] = GetWARPContext();
@@ -249,6 +294,275 @@ TEST(OpenCLOn12, RecursiveFlush)
     EXPECT_EQ(queue1Task2.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>(), CL_COMPLETE);
 }
 
+// Not a correctness test, reports the cost of clSetKernelArg for a kernel with many arguments,
+// so that changes to argument binding can be compared before and after.
+TEST(OpenCLOn12, SetKernelArgPerf)
+{
+    auto&& [context, device] = GetWARPContext();
+    cl::CommandQueue queue(context, device);
+
+    constexpr cl_uint NumBufferArgs = 16;
+    std::string kernel_source = "__kernel void many_args(";
+    for (cl_uint i = 0; i < NumBufferArgs; ++i)
+    {
+        kernel_source += "__global uint *b" + std::to_string(i) + ", uint v" + std::to_string(i) + (i + 1 < NumBufferArgs ? ", " : ")\n");
+    }
+    kernel_source += "{\n";
+    for (cl_uint i = 0; i < NumBufferArgs; ++i)
+    {
+        kernel_source += "    b" + std::to_string(i) + "[get_global_id(0)] = v" + std::to_string(i) + ";\n";
+    }
+    kernel_source += "}\n";
+
+    cl::Program program(context, kernel_source, true /*build*/);
+    cl::Kernel kernel(program, "many_args");
+
+    std::vector<cl::Buffer> buffers;
+    for (cl_uint i = 0; i < NumBufferArgs; ++i)
+    {
+        buffers.emplace_back(context, (cl_mem_flags)(CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE), sizeof(uint32_t));
+    }
+
+    auto SetAllArgs = [&](cl_uint iteration)
+    {
+        for (cl_uint i = 0; i < NumBufferArgs; ++i)
+        {
+            cl_mem mem = buffers[i]();
+            cl_uint value = iteration + i;
+            ASSERT_EQ(clSetKernelArg(kernel(), i * 2, sizeof(mem), &mem), CL_SUCCESS);
+            ASSERT_EQ(clSetKernelArg(kernel(), i * 2 + 1, sizeof(value), &value), CL_SUCCESS);
+        }
+    };
+
+    constexpr cl_uint Iterations = 10000;
+    SetAllArgs(0);
+    auto Start = std::chrono::steady_clock::now();
+    for (cl_uint iteration = 0; iteration < Iterations; ++iteration)
+    {
+        SetAllArgs(iteration);
+    }
+    auto Elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start);
+    printf("clSetKernelArg: %.1f ns per call\n", (double)Elapsed.count() / (Iterations * NumBufferArgs * 2));
+
+    // Make sure the last set of arguments is what the kernel sees
+    queue.enqueueNDRangeKernel(kernel, 0, 1);
+    for (cl_uint i = 0; i < NumBufferArgs; ++i)
+    {
+        uint32_t result = 0;
+        queue.enqueueReadBuffer(buffers[i], true, 0, sizeof(result), &result);
+        EXPECT_EQ(result, Iterations - 1 + i);
+    }
+
+    // Same thing through cl_msft_set_kernel_args, which sets the whole argument block at once
+    using SetKernelArgsFn = cl_int(CL_API_CALL*)(cl_kernel, cl_uint, cl_uint, const size_t*, const void* const*);
+    auto pfnSetKernelArgs = reinterpret_cast<SetKernelArgsFn>(
+        clGetExtensionFunctionAddressForPlatform(device.getInfo<CL_DEVICE_PLATFORM>(), "clSetKernelArgsMSFT"));
+    ASSERT_NE(pfnSetKernelArgs, nullptr);
+
+    std::vector<cl_mem> mems(NumBufferArgs);
+    std::vector<cl_uint> values(NumBufferArgs);
+    std::vector<size_t> sizes(NumBufferArgs * 2);
+    std::vector<const void*> pointers(NumBufferArgs * 2);
+    for (cl_uint i = 0; i < NumBufferArgs; ++i)
+    {
+        mems[i] = buffers[i]();
+        sizes[i * 2] = sizeof(cl_mem);
+        sizes[i * 2 + 1] = sizeof(cl_uint);
+        pointers[i * 2] = &mems[i];
+        pointers[i * 2 + 1] = &values[i];
+    }
+
+    Start = std::chrono::steady_clock::now();
+    for (cl_uint iteration = 0; iteration < Iterations; ++iteration)
+    {
+        for (cl_uint i = 0; i < NumBufferArgs; ++i)
+        {
+            values[i] = iteration * 2 + i;
+        }
+        ASSERT_EQ(pfnSetKernelArgs(kernel(), 0, NumBufferArgs * 2, sizes.data(), pointers.data()), CL_SUCCESS);
+    }
+    Elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start);
+    printf("clSetKernelArgsMSFT: %.1f ns per argument\n", (double)Elapsed.count() / (Iterations * NumBufferArgs * 2));
+
+    // A bad argument anywhere in the block leaves all of them untouched
+    sizes[NumBufferArgs * 2 - 1] = sizeof(cl_ulong);
+    values[0] = 0;
+    EXPECT_EQ(pfnSetKernelArgs(kernel(), 0, NumBufferArgs * 2, sizes.data(), pointers.data()), CL_INVALID_ARG_SIZE);
+    EXPECT_EQ(pfnSetKernelArgs(kernel(), 1, NumBufferArgs * 2, sizes.data(), pointers.data()), CL_INVALID_ARG_INDEX);
+
+    queue.enqueueNDRangeKernel(kernel, 0, 1);
+    for (cl_uint i = 0; i < NumBufferArgs; ++i)
+    {
+        uint32_t result = 0;
+        queue.enqueueReadBuffer(buffers[i], true, 0, sizeof(result), &result);
+        EXPECT_EQ(result, (Iterations - 1) * 2 + i);
+    }
+}
+
+// Not a correctness test, reports how long it takes to specialize a kernel for a new configuration,
+// so that changes to the compiler path can be compared before and after.
+TEST(OpenCLOn12, SpecializationPerf)
+{
+    auto&& [context, device] = GetWARPContext();
+    cl::CommandQueue queue(context, device);
+
+    const char* kernel_source =
+    "__kernel void local_arg(__global uint *output, __local uint *scratch, uint count)\n\
+    {\n\
+        for (uint i = 0; i < count; ++i)\n\
+            scratch[i] = i;\n\
+        output[0] = scratch[count - 1];\n\
+    }\n";
+
+    cl::Program program(context, kernel_source, true /*build*/);
+    cl::Kernel kernel(program, "local_arg");
+    cl::Buffer output(context, (cl_mem_flags)(CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE), sizeof(cl_uint));
+    kernel.setArg(0, output);
+
+    // Each distinct local memory size needs its own specialization
+    constexpr cl_uint Specializations = 64;
+    auto Start = std::chrono::steady_clock::now();
+    for (cl_uint i = 1; i <= Specializations; ++i)
+    {
+        kernel.setArg(1, cl::Local(sizeof(cl_uint) * i));
+        kernel.setArg(2, i);
+        queue.enqueueNDRangeKernel(kernel, 0, 1);
+    }
+    queue.finish();
+    auto Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start);
+    printf("Specialization: %.1f us per kernel\n", (double)Elapsed.count() / Specializations);
+
+    cl_uint result = 0;
+    queue.enqueueReadBuffer(output, true, 0, sizeof(result), &result);
+    EXPECT_EQ(result, Specializations - 1);
+}
+
+TEST(OpenCLOn12, ProgramBinaryRoundTrip)
+{
+    auto&& [context, device] = GetWARPContext();
+    cl::CommandQueue queue(context, device);
+
+    const char* kernel_source =
+    "__kernel void scale(__global uint *output, uint factor)\n\
+    {\n\
+        output[get_global_id(0)] = get_global_id(0) * factor;\n\
+    }\n";
+
+    cl::Program source_program(context, kernel_source, true /*build*/);
+    auto binaries = source_program.getInfo<CL_PROGRAM_BINARIES>();
+    ASSERT_EQ(binaries.size(), 1u);
+
+    constexpr size_t width = 16;
+    auto BuildAndRun = [&, &context = context, &device = device](cl::Program::Binaries const& program_binaries, cl_uint factor, bool used_embedded_dxil)
+    {
+        std::vector<cl_int> binary_status;
+        cl::Program program(context, { device }, program_binaries, &binary_status);
+        ASSERT_EQ(binary_status[0], CL_SUCCESS);
+        program.build();
+        auto log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+        EXPECT_EQ(log.find("Using the DXIL embedded in the program binary.") != std::string::npos, used_embedded_dxil) << log;
+
+        cl::Buffer output(context, (cl_mem_flags)(CL_MEM_ALLOC_HOST_PTR | CL_MEM_READ_WRITE), width * sizeof(cl_uint));
+        cl::Kernel kernel(program, "scale");
+        kernel.setArg(0, output);
+        kernel.setArg(1, factor);
+        queue.enqueueNDRangeKernel(kernel, 0, width);
+
+        cl_uint result[width] = {};
+        queue.enqueueReadBuffer(output, true, 0, sizeof(result), result);
+        for (cl_uint i = 0; i < width; ++i)
+        {
+            EXPECT_EQ(result[i], i * factor);
+        }
+    };
+    BuildAndRun(binaries, 3, true);
+
+    // A damaged binary still works, since DXIL that doesn't match its checksum is regenerated from the SPIR-V
+    auto damaged = binaries;
+    damaged[0].back() ^= 0xff;
+    BuildAndRun(damaged, 5, false);
+}
+
+TEST(OpenCLOn12, LargeSubBufferCopy)
+{
+    auto&& [context, device] = GetWARPContext();
+    cl::CommandQueue queue(context, device);
+
+    // Large enough to use the copy queue, with sub-buffers that don't start at their parents' start
+    constexpr size_t copy_size = 16 * 1024 * 1024 + 4096;
+    constexpr size_t num_elements = copy_size / sizeof(cl_uint);
+    const size_t offset = device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8 * 4;
+    const size_t parent_size = offset + copy_size;
+
+    std::vector<cl_uint> source_data(parent_size / sizeof(cl_uint));
+    std::iota(source_data.begin(), source_data.end(), 0u);
+    cl::Buffer source_parent(context, CL_MEM_READ_WRITE, parent_size);
+    cl::Buffer dest_parent(context, CL_MEM_READ_WRITE, parent_size * 2);
+    queue.enqueueWriteBuffer(source_parent, false, 0, parent_size, source_data.data());
+    queue.enqueueFillBuffer(dest_parent, 0xdeaddeadu, 0, parent_size * 2);
+
+    auto SubBuffer = [](cl::Buffer& parent, size_t origin)
+    {
+        cl_buffer_region region = { origin, copy_size };
+        return parent.createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region);
+    };
+    cl::Buffer source = SubBuffer(source_parent, offset);
+    cl::Buffer dest = SubBuffer(dest_parent, offset);
+    cl::Buffer dest_copy = SubBuffer(dest_parent, parent_size);
+
+    // One copy between different parents, then one from that result within the same parent
+    queue.enqueueCopyBuffer(source, dest, 0, 0, copy_size);
+    queue.enqueueCopyBuffer(dest, dest_copy, 0, 0, copy_size);
+
+    std::vector<cl_uint> result(parent_size * 2 / sizeof(cl_uint));
+    queue.enqueueReadBuffer(dest_parent, true, 0, parent_size * 2, result.data());
+
+    const size_t first = offset / sizeof(cl_uint);
+    const size_t second = parent_size / sizeof(cl_uint);
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        cl_uint expected = 0xdeaddead;
+        if (i >= first && i < first + num_elements)
+            expected = source_data[i];
+        else if (i >= second && i < second + num_elements)
+            expected = source_data[i - second + first];
+        ASSERT_EQ(result[i], expected) << "at element " << i;
+    }
+}
+
+TEST(OpenCLOn12, LargeCopyCompletion)
+{
+    auto&& [context, device] = GetWARPContext();
+    cl::CommandQueue queue(context, device);
+
+    // Large enough for the copy queue, if the buffers can use it
+    constexpr size_t copy_size = 16 * 1024 * 1024 + 4096;
+    std::vector<cl_uint> source_data(copy_size / sizeof(cl_uint));
+    std::iota(source_data.begin(), source_data.end(), 0u);
+    cl::Buffer source(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, copy_size, source_data.data());
+
+    // Once a copy's event is complete, the host sees the copy's result without any further
+    // commands being enqueued, whether the destination is mapped directly or through a staging copy
+    for (cl_mem_flags flags : { CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, CL_MEM_READ_WRITE })
+    {
+        cl::Buffer dest(context, flags, copy_size);
+        queue.enqueueFillBuffer(dest, 0xdeaddeadu, 0, copy_size);
+        cl::Event copied;
+        queue.enqueueCopyBuffer(source, dest, 0, 0, copy_size, nullptr, &copied);
+        queue.flush();
+        copied.wait();
+        ASSERT_EQ(copied.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>(), CL_COMPLETE);
+
+        auto mapped = static_cast<cl_uint*>(queue.enqueueMapBuffer(dest, true, CL_MAP_READ, 0, copy_size));
+        for (size_t i = 0; i < source_data.size(); ++i)
+        {
+            ASSERT_EQ(mapped[i], source_data[i]) << "at element " << i;
+        }
+        queue.enqueueUnmapMemObject(dest, mapped);
+        queue.finish();
+    }
+}
+
 TEST(OpenCLOn12, SPIRV)
 {
     // This is the pre-assembled SPIR-V from the compiler DLL's "spec_constant" test: